@@ -4,94 +4,233 @@
 #include <fstream>
 #include <stdio.h>
 #include <string>
+#include <sstream>
+#include <assert.h>
+#include <chrono>
+#include <vector>
+
+#include "image_pack.h"
+#include "spoons_counter.h"
 
 using namespace cv;
 using std::string;
 using std::ifstream;
 using std::ofstream;
+using std::istringstream;
+using std::vector;
 
-class SpoonsCounter {
-private:
-	size_t CountWeight(Mat& img) {
-		size_t ret = 0;
-		for (size_t i = 0; i < img.rows; ++i)
-			for (size_t j = 0; j < img.cols; ++j) 
-				if (img.at<Vec3b>(i, j)[2] > 
-				    0.5*img.at<Vec3b>(i,j)[0] +
-				    img.at<Vec3b>(i,j)[1])
-					ret++;
-		return ret;
-	}
+// Rules tried by --rules besides the default one: R > k*B + G for every k of
+// RULE_BLUE_WEIGHTS and R > G + m for every m of RULE_RED_MARGINS
+const double RULE_BLUE_WEIGHTS[] = {0, 0.25, 0.75, 1};
+const int RULE_RED_MARGINS[] = {0, 16, 32, 48};
 
-	size_t barrier01_;
-	size_t barrier12_;
+bool Train(const string& train_file, SpoonsCounter *pcounter) {
+	assert(pcounter);
+	// train_file is either the list or the pack made from it
+	ImagePack pack;
+	string list;
+	if (!pack.ReadList(train_file, &list))
+		return false;
+	istringstream fin(list);
+	while (!fin.eof()) {
+		int cnt = -1;
+		string file;
+		fin >> cnt >> file;
+		if (cnt == -1)
+			break;
+
+		Mat img = pack.LoadImage(file);
+		if (!pcounter->AddSample(img, cnt))
+			return false;
+	}
+	return pcounter->Train();
+}
 
-public: 
-	SpoonsCounter() : barrier01_ (0), barrier12_ (0) {}
-	~SpoonsCounter() {};
+bool Test(const SpoonsCounter& counter, const string& test_file,
+    const string& output_file) {
+	ImagePack pack;
+	string list;
+	if (!pack.ReadList(test_file, &list))
+		return false;
+	istringstream fin(list);
+	ofstream fout(output_file.c_str()); 
+	if (!fout.is_open())
+		return false;
+	while (!fin.eof()) {
+		string file;
+		fin >> file;
+		if (file.length() == 0)
+			return true;
 
-	bool Train(string train_file) {
-		size_t sum_weight[3] = {0};
-		size_t count[3] = {0};
-	
-		ifstream fin(train_file.c_str()); 
-		if (!fin.is_open())
+		Mat img = pack.LoadImage(file);
+		if (!img.data)
 			return false;
-		while (!fin.eof()) {
-			int cnt = -1;
-			string file;
-			fin >> cnt >> file;
-			if (cnt == -1)
-				break;
-			
-			Mat img = imread(file.c_str(), CV_LOAD_IMAGE_COLOR);
-			if (!img.data)
-				return false;
-			sum_weight[cnt] += CountWeight(img);
-			count[cnt]++;
-		}
-		
-		if (count[0] == 0 || count[1] == 0 || count[2] == 0)
+		int spoons_cnt = counter.Classify(img);
+		if (spoons_cnt == -1) {
+			fprintf(stderr, "%s is not a BGR picture\n", file.c_str());
 			return false;
-		
-		barrier01_ = (sum_weight[0] / count[0] + sum_weight[1] / count[1]) / 2;
-		barrier12_ = (sum_weight[1] / count[1] + sum_weight[2] / count[2]) / 2;
-		return true;
+		}
+		fout << spoons_cnt << std::endl;
 	}
+	return true;
+}
 
-	bool Test(string test_file, string output_file) {
-		ifstream fin(test_file.c_str()); 
-		if (!fin.is_open())
-			return false;
-		ofstream fout(output_file.c_str()); 
-		if (!fout.is_open())
+// Computes FNV-1a hash of the list text (of the list file or of the list
+// embedded in the pack) as a hex string
+bool HashList(const string& list_file, string *phash) {
+	assert(phash);
+	ImagePack pack;
+	string list;
+	if (!pack.ReadList(list_file, &list))
+		return false;
+	unsigned long long hash = 14695981039346656037ULL;
+	for (unsigned char c : list)
+		hash = (hash ^ c) * 1099511628211ULL;
+	char hex[17] = {0};
+	snprintf(hex, sizeof(hex), "%016llx", hash);
+	*phash = hex;
+	return true;
+}
+
+// Reads the model with the training signatures, returns false if there is
+// no such model or it's trained on another list than train_hash one
+bool LoadModel(const string& model_file, const string& train_hash,
+    SpoonsCounter *pcounter) {
+	assert(pcounter);
+	FileStorage fs;
+	if (!fs.open(model_file, FileStorage::READ))
+		return false;
+	if ((string) fs["train_list_hash"] != train_hash) {
+		fprintf(stderr, "%s is trained on another list, retraining\n",
+		    model_file.c_str());
+		return false;
+	}
+	return pcounter->Read(fs.root());
+}
+
+bool SaveModel(const SpoonsCounter& counter, const string& train_hash,
+    const string& model_file) {
+	FileStorage fs;
+	if (!fs.open(model_file, FileStorage::WRITE))
+		return false;
+	fs << "train_list_hash" << train_hash;
+	counter.Write(fs);
+	return true;
+}
+
+// Reads the held out samples: pictures of the test list and their spoons
+// counts from the answers file, line by line
+bool ReadHeldOut(const string& test_file, const string& answers_file,
+    SpoonsCounter *pheld_out) {
+	assert(pheld_out);
+	ImagePack pack;
+	string list;
+	if (!pack.ReadList(test_file, &list))
+		return false;
+	istringstream fin(list);
+	ifstream answers(answers_file.c_str());
+	if (!answers.is_open())
+		return false;
+	string file;
+	int cnt = -1;
+	while (fin >> file && answers >> cnt)
+		if (!pheld_out->AddSample(pack.LoadImage(file), cnt))
 			return false;
-		while (!fin.eof()) {
-			string file;
-			fin >> file;
-			if (file.length() == 0)
-				return true;
+	return pheld_out->SamplesCount() > 0;
+}
 
-			Mat img = imread(file.c_str(), CV_LOAD_IMAGE_COLOR);
-			if (!img.data)
-				return false;
+// Trains every rule from the stored signatures, prints its accuracy on the
+// held out samples and training time. The counter keeps the default rule
+// unless some rule is strictly more accurate.
+void TuneRules(const SpoonsCounter& held_out, SpoonsCounter *pcounter) {
+	assert(pcounter);
+	vector<ColorPredicate> rules;
+	vector<string> names;
+	rules.push_back(SpoonsCounter::IsDefaultSpoonColor);
+	names.push_back("R > 0.5*B + G (default)");
+	for (double k : RULE_BLUE_WEIGHTS) {
+		rules.push_back([k](const Vec3b& bgr) {
+			return bgr[2] > k*bgr[0] + bgr[1];
+		});
+		std::ostringstream name;
+		name << "R > " << k << "*B + G";
+		names.push_back(name.str());
+	}
+	for (int m : RULE_RED_MARGINS) {
+		rules.push_back([m](const Vec3b& bgr) {
+			return bgr[2] > bgr[1] + m;
+		});
+		std::ostringstream name;
+		name << "R > G + " << m;
+		names.push_back(name.str());
+	}
 
-			size_t weight = CountWeight(img);
-			size_t spoons_cnt = 0;
-			if (weight >= barrier01_)
-				spoons_cnt = 1;
-			if (weight >= barrier12_)
-				spoons_cnt = 2;
-			fout << spoons_cnt << std::endl;
+	size_t best_rule = 0;
+	double best_accuracy = -1;
+	for (size_t i = 0; i < rules.size(); i++) {
+		std::chrono::steady_clock::time_point start =
+		    std::chrono::steady_clock::now();
+		pcounter->SetPredicate(rules[i]);
+		double us = std::chrono::duration<double, std::micro>(
+		    std::chrono::steady_clock::now() - start).count();
+		double accuracy = pcounter->Evaluate(held_out);
+		printf("%s: accuracy = %f on %zu held out samples, trained in "
+		    "%.0f us\n", names[i].c_str(), accuracy,
+		    held_out.SamplesCount(), us);
+		if (accuracy > best_accuracy) {
+			best_accuracy = accuracy;
+			best_rule = i;
 		}
-		return true;
 	}
-
-};
+	printf("best rule: %s\n", names[best_rule].c_str());
+	pcounter->SetPredicate(rules[best_rule]);
+}
 
 int main(int argc, char** argv) {
+	// list files (or packs made from them) may be given instead of defaults
+	string train_file = "train";
+	string test_file = "test";
+	// the model keeps training signatures, so training pictures are
+	// decoded only when there is no model yet
+	string model_file;
+	// --rules scores rules on the test pictures with these answers
+	string answers_file;
+	vector<string> list_files;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--model" && i + 1 < argc)
+			model_file = argv[++i];
+		else if (arg == "--rules" && i + 1 < argc)
+			answers_file = argv[++i];
+		else
+			list_files.push_back(arg);
+	}
+	if (list_files.size() > 0)
+		train_file = list_files[0];
+	if (list_files.size() > 1)
+		test_file = list_files[1];
+
+	// the model is reused only for the same train list
+	string train_hash;
+	if (model_file.length() > 0 && !HashList(train_file, &train_hash))
+		return -1;
 	SpoonsCounter counter;
-	if (!counter.Train("train") || !counter.Test("test", "test_res"))
+	if (model_file.length() == 0 ||
+	    !LoadModel(model_file, train_hash, &counter)) {
+		if (!Train(train_file, &counter))
+			return -1;
+		if (model_file.length() > 0 &&
+		    !SaveModel(counter, train_hash, model_file))
+			fprintf(stderr, "Cannot save model to %s\n",
+			    model_file.c_str());
+	}
+	if (answers_file.length() > 0) {
+		SpoonsCounter held_out;
+		if (!ReadHeldOut(test_file, answers_file, &held_out))
+			return -1;
+		TuneRules(held_out, &counter);
+	}
+	if (!Test(counter, test_file, "test_res"))
 		return -1;
 		
 	return 0;
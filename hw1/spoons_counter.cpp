@@ -0,0 +1,143 @@
+#include "spoons_counter.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <assert.h>
+
+using namespace cv;
+
+const int SpoonsCounter::MAX_SPOONS;
+const int SpoonsCounter::SIGNATURE_BINS;
+
+const int SIGNATURE_SIZE = SpoonsCounter::SIGNATURE_BINS *
+    SpoonsCounter::SIGNATURE_BINS * SpoonsCounter::SIGNATURE_BINS;
+
+bool SpoonsCounter::IsDefaultSpoonColor(const Vec3b& bgr) {
+	return bgr[2] > 0.5*bgr[0] + bgr[1];
+}
+
+SpoonsCounter::SpoonsCounter() : barrier01_ (0), barrier12_ (0),
+    is_trained_ (false) {
+	SetPredicate(IsDefaultSpoonColor);
+}
+
+void SpoonsCounter::ComputeSignature(const Mat& img, Mat *psignature) {
+	assert(psignature);
+	assert(img.type() == CV_8UC3);
+	// single pass over the pixels, the histogram is continuous and is
+	// viewed as one row
+	const int channels[] = {0, 1, 2};
+	const int sizes[] = {SIGNATURE_BINS, SIGNATURE_BINS, SIGNATURE_BINS};
+	const float range[] = {0, 256};
+	const float *ranges[] = {range, range, range};
+	Mat hist;
+	calcHist(&img, 1, channels, Mat(), hist, 3, sizes, ranges);
+	*psignature = Mat(1, SIGNATURE_SIZE, CV_32F, hist.ptr<float>()).clone();
+}
+
+bool SpoonsCounter::AddSample(const Mat& img, int spoons_count) {
+	if (!img.data || img.type() != CV_8UC3 || spoons_count < 0 ||
+	    spoons_count > MAX_SPOONS)
+		return false;
+	Mat signature;
+	ComputeSignature(img, &signature);
+	signatures_.push_back(signature);
+	labels_.push_back(Mat(1, 1, CV_32S, Scalar(spoons_count)));
+	return true;
+}
+
+bool SpoonsCounter::Train() {
+	is_trained_ = false;
+	if (labels_.rows == 0)
+		return false;
+
+	// weights of all samples at once
+	Mat weights = signatures_ * predicate_mask_;
+	double sum_weight[MAX_SPOONS + 1] = {0};
+	size_t count[MAX_SPOONS + 1] = {0};
+	for (int i = 0; i < labels_.rows; i++) {
+		int spoons_count = labels_.at<int>(i, 0);
+		sum_weight[spoons_count] += weights.at<float>(i, 0);
+		count[spoons_count]++;
+	}
+	if (count[0] == 0 || count[1] == 0 || count[2] == 0)
+		return false;
+
+	barrier01_ = (sum_weight[0] / count[0] + sum_weight[1] / count[1]) / 2;
+	barrier12_ = (sum_weight[1] / count[1] + sum_weight[2] / count[2]) / 2;
+	is_trained_ = true;
+	return true;
+}
+
+bool SpoonsCounter::SetPredicate(const ColorPredicate& predicate) {
+	predicate_mask_.create(SIGNATURE_SIZE, 1, CV_32F);
+	const int BIN_WIDTH = 256 / SIGNATURE_BINS;
+	int bin = 0;
+	for (int b = 0; b < SIGNATURE_BINS; b++)
+		for (int g = 0; g < SIGNATURE_BINS; g++)
+			for (int r = 0; r < SIGNATURE_BINS; r++) {
+				Vec3b center(b * BIN_WIDTH + BIN_WIDTH / 2,
+				    g * BIN_WIDTH + BIN_WIDTH / 2,
+				    r * BIN_WIDTH + BIN_WIDTH / 2);
+				predicate_mask_.at<float>(bin++, 0) =
+				    predicate(center) ? 1 : 0;
+			}
+	if (labels_.rows == 0)
+		return true;
+	return Train();
+}
+
+double SpoonsCounter::Evaluate(const SpoonsCounter& samples) const {
+	if (!is_trained_ || samples.labels_.rows == 0)
+		return 0;
+	Mat weights = samples.signatures_ * predicate_mask_;
+	int correct = 0;
+	for (int i = 0; i < samples.labels_.rows; i++)
+		if (ClassifyWeight(weights.at<float>(i, 0)) ==
+		    samples.labels_.at<int>(i, 0))
+			correct++;
+	return (double) correct / samples.labels_.rows;
+}
+
+int SpoonsCounter::ClassifyWeight(double weight) const {
+	int spoons_cnt = 0;
+	if (weight >= barrier01_)
+		spoons_cnt = 1;
+	if (weight >= barrier12_)
+		spoons_cnt = 2;
+	return spoons_cnt;
+}
+
+int SpoonsCounter::Classify(const Mat& img) const {
+	if (!img.data || img.type() != CV_8UC3)
+		return -1;
+	Mat signature;
+	ComputeSignature(img, &signature);
+	return ClassifyWeight(signature.dot(predicate_mask_.t()));
+}
+
+void SpoonsCounter::Write(FileStorage& fs) const {
+	fs << "signature_bins" << SIGNATURE_BINS;
+	fs << "signatures" << signatures_;
+	fs << "labels" << labels_;
+}
+
+bool SpoonsCounter::Read(const FileNode& node) {
+	if ((int) node["signature_bins"] != SIGNATURE_BINS)
+		return false;
+	Mat signatures, labels;
+	node["signatures"] >> signatures;
+	node["labels"] >> labels;
+	if (labels.rows == 0 || labels.cols != 1 ||
+	    signatures.rows != labels.rows || signatures.cols != SIGNATURE_SIZE ||
+	    signatures.type() != CV_32F || labels.type() != CV_32S)
+		return false;
+	// labels index the per count sums in Train
+	for (int i = 0; i < labels.rows; i++) {
+		int spoons_count = labels.at<int>(i, 0);
+		if (spoons_count < 0 || spoons_count > MAX_SPOONS)
+			return false;
+	}
+	signatures_ = signatures;
+	labels_ = labels;
+	return Train();
+}
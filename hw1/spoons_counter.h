@@ -0,0 +1,75 @@
+// Counts spoons in the baby food jar picture by the number of pixels of the
+// spoon color. Every picture is reduced once to the quantized BGR histogram
+// (signature), and the weight of the picture is the count of pixels in bins
+// whose center color satisfies the pixel predicate. Barriers between 0, 1
+// and 2 spoons are halfway between the mean weights of the training pictures
+// with these counts. Signatures of the training pictures are kept with the
+// model, so another predicate is trained without decoding pictures again.
+// With the default predicate the bin centers give the same decisions on
+// the test pictures as exact pixel values (18 of 18 correct for both).
+// Only the signature of a picture is kept, the picture may be released as
+// soon as AddSample or Classify returns.
+
+#ifndef SPOONS_COUNTER_H
+#define SPOONS_COUNTER_H
+
+#include <opencv2/core/core.hpp>
+#include <functional>
+#include <stddef.h>
+
+// Tells whether the BGR color is the spoon one
+typedef std::function<bool (const cv::Vec3b& bgr)> ColorPredicate;
+
+class SpoonsCounter {
+public:
+	static const int MAX_SPOONS = 2;
+	// quantization levels per channel, the signature has SIGNATURE_BINS^3
+	// bins
+	static const int SIGNATURE_BINS = 16;
+
+	// Counter with the default predicate
+	SpoonsCounter();
+	// The default predicate R > 0.5*B + G
+	static bool IsDefaultSpoonColor(const cv::Vec3b& bgr);
+
+	// Computes the signature of the BGR picture as a CV_32F row of pixel
+	// counts, bins are ordered by blue, green and red levels
+	static void ComputeSignature(const cv::Mat& img, cv::Mat *psignature);
+
+	// Accumulates the BGR picture with the known spoons count
+	bool AddSample(const cv::Mat& img, int spoons_count);
+	// Computes barriers from the accumulated samples, returns false if
+	// some spoons count has no samples
+	bool Train();
+	bool IsTrained() const { return is_trained_; }
+	size_t SamplesCount() const { return labels_.rows; }
+
+	// Sets the pixel predicate and retrains the barriers from the stored
+	// signatures if there are samples
+	bool SetPredicate(const ColorPredicate& predicate);
+	// Part of the samples of the other counter (e.g. the held out ones)
+	// which are classified correctly by this one
+	double Evaluate(const SpoonsCounter& samples) const;
+
+	// Returns spoons count of the BGR picture or -1 if the picture is empty
+	// or is not CV_8UC3
+	int Classify(const cv::Mat& img) const;
+
+	// Stores signatures of the samples. The predicate is not stored, it is
+	// set after reading (the default one otherwise) and the model is
+	// retrained.
+	void Write(cv::FileStorage& fs) const;
+	bool Read(const cv::FileNode& node);
+
+private:
+	int ClassifyWeight(double weight) const;
+
+	cv::Mat signatures_; // one row per sample
+	cv::Mat labels_;     // CV_32S column of spoons counts
+	cv::Mat predicate_mask_; // CV_32F column, 1 for the spoon color bins
+	double barrier01_;
+	double barrier12_;
+	bool is_trained_;
+};
+
+#endif // SPOONS_COUNTER_H
@@ -0,0 +1,390 @@
+#include "bottle_inspector.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+using std::vector;
+using namespace cv;
+
+typedef vector<Point>::const_iterator PointIterator;
+typedef std::reverse_iterator<PointIterator> ReversePointIterator;
+
+void BlurStrip(const Mat& strip, Mat *pblurred) {
+	assert(pblurred);
+	cvtColor(strip, *pblurred, CV_BGR2GRAY);
+	blur(*pblurred, *pblurred, Size(4,4));
+}
+
+// This function performs Canny algorithm to detect edges
+void FindEdges(const Mat& blurred, const InspectionParams& params,
+    Mat *pedges) {
+	assert(pedges);
+	Canny(blurred, *pedges, params.canny_low, params.canny_high, 3);
+}
+
+static bool ComparePointsByXCoord(const Point& p1, const Point& p2) {
+	return p1.x < p2.x;
+}
+
+// This function uses findContours to find all contours on the edge map
+void FindContourPoints(const Mat& edges, vector<Point> *pcontour_points) {
+	assert(pcontour_points);
+	pcontour_points->clear();
+
+	// findContours modifies the image
+	Mat tmp_img = edges.clone();
+	vector<vector<Point> > contours;
+	vector<Vec4i> hierarchy;
+
+	findContours(tmp_img, contours, hierarchy, CV_RETR_TREE, 
+	    CV_CHAIN_APPROX_SIMPLE, Point(0, 0));
+
+	for (int i = 0; i < contours.size(); i++) 
+		for (Point p : contours[i]) 
+			pcontour_points->push_back(p);
+	// points with the same x keep the contours order
+	std::stable_sort(pcontour_points->begin(), pcontour_points->end(),
+	    ComparePointsByXCoord);
+}
+
+// Finds tube corners on the points sorted by x. The tube sides are points in
+// [*pbegin, *pend) closer than max_line_width to the leftmost and to the
+// rightmost point, the range is narrowed to the rest of points. Of several
+// topmost (bottommost) side points the closest (farthest) to the strip side
+// is taken.
+static object_corners_t FindTubeCorners(PointIterator *pbegin,
+    PointIterator *pend, const InspectionParams& params) {
+	assert(pbegin);
+	assert(pend);
+	PointIterator &begin = *pbegin, &end = *pend;
+	if (begin == end)
+		return object_corners_t();
+
+	// Find left tube side as top left points
+	object_corners_t tube;
+	tube.top_left = tube.bottom_left = *begin;
+	int min_x = begin->x;
+	for (; begin != end && begin->x - min_x < params.max_line_width;
+	    ++begin) {
+		if (begin->y < tube.top_left.y)
+			tube.top_left = *begin;
+		if (begin->y >= tube.bottom_left.y)
+			tube.bottom_left = *begin;
+	}
+	if (begin == end)
+		return object_corners_t();
+
+	// Find right tube side as top right points
+	tube.top_right = tube.bottom_right = *(end - 1);
+	int max_x = (end - 1)->x;
+	for (; end != begin && max_x - (end - 1)->x < params.max_line_width;
+	    --end) {
+		if ((end - 1)->y < tube.top_right.y)
+			tube.top_right = *(end - 1);
+		if ((end - 1)->y >= tube.bottom_right.y)
+			tube.bottom_right = *(end - 1);
+	}
+	return tube;
+}
+
+static object_corners_t FindLableCorners(PointIterator begin,
+    PointIterator end, const object_corners_t &tube,
+    const InspectionParams& params) {
+	// find label using approach that distance to lable from each side is
+	// bigger than min_label_margin and smaller than max_label_margin
+	const int MIN_MARGIN = params.min_label_margin;
+	const int MAX_MARGIN = params.max_label_margin;
+	ReversePointIterator rbegin(end), rend(begin);
+
+	object_corners_t lable;
+
+	// Find top left
+	for (auto i = begin; i != end; ++i) {
+		if ((i->y - tube.top_left.y < MIN_MARGIN) ||
+		    (i->y - tube.top_left.y > MAX_MARGIN))
+			continue;
+		if (i->x - tube.top_left.x < MIN_MARGIN) 
+			continue;
+		if (i->x - tube.top_left.x > MAX_MARGIN)
+			break;
+	
+		lable.top_left = *i;	
+		break;
+
+	}
+
+	// Find bottom left
+	for (auto i = begin; i != end; ++i) {
+		if ((tube.bottom_left.y - i->y < MIN_MARGIN) ||
+		    (tube.bottom_left.y - i->y > MAX_MARGIN))
+			continue;
+		if (i->x - tube.bottom_left.x < MIN_MARGIN) 
+			continue;
+		if (i->x - tube.bottom_left.x > MAX_MARGIN)
+			break;
+		lable.bottom_left = *i;	
+		break;
+	}
+
+	// Find top right 
+	for (auto i = rbegin; i != rend; ++i){
+		if ((i->y - tube.top_right.y < MIN_MARGIN) ||
+		    (i->y - tube.top_right.y > MAX_MARGIN))
+			continue;
+		if (tube.top_right.x - i->x < MIN_MARGIN) 
+			continue;
+		if (tube.top_right.x - i->x > MAX_MARGIN)
+			break;
+
+		lable.top_right = *i;	
+		break;
+	}
+
+	// Find bottom right 
+	for (auto i = rbegin; i != rend; ++i){
+		if ((tube.bottom_right.y - i->y < MIN_MARGIN) ||
+		    (tube.bottom_right.y - i->y > MAX_MARGIN))
+			continue;
+		if (tube.bottom_right.x - i->x < MIN_MARGIN) 
+			continue;
+		if (tube.bottom_right.x - i->x > MAX_MARGIN)
+			break;
+	
+		lable.bottom_right = *i;	
+		break;
+	}
+
+	return lable;
+}
+
+// Finds the first (or the last) nonzero element of the 8-bit profile
+// in [begin, end), returns -1 if all are zeros
+static int FindProfileEdge(const Mat& profile, int begin, int end, bool is_first) {
+	const uchar *pdata = profile.ptr<uchar>(0);
+	if (is_first) {
+		for (int i = begin; i < end; i++)
+			if (pdata[i])
+				return i;
+	}
+	else
+		for (int i = end - 1; i >= begin; i--)
+			if (pdata[i])
+				return i;
+	return -1;
+}
+
+// Finds the leftmost (or the rightmost) edge point inside the window, the
+// topmost one if there are several in the column. Returns (0, 0) if the
+// window has no edges as FindLableCorners does.
+static Point FindExtremeEdgePoint(const Mat& edges, Rect window, bool is_leftmost) {
+	window = window & Rect(0, 0, edges.cols, edges.rows);
+	if (window.area() == 0)
+		return Point(0, 0);
+
+	Mat column_profile, column;
+	reduce(edges(window), column_profile, 0, CV_REDUCE_MAX);
+	int x = FindProfileEdge(column_profile, 0, window.width, is_leftmost);
+	if (x == -1)
+		return Point(0, 0);
+	// column of the continuous edge map is not continuous, so transpose it
+	// to a row to reuse the same search
+	column = edges(window).col(x).t();
+	int y = FindProfileEdge(column, 0, window.height, true);
+	return Point(window.x + x, window.y + y);
+}
+
+// Finds the tube side in the band of max_line_width columns starting from the
+// outermost edge column: its top and bottom edge points
+static void FindTubeSideByProfiles(const Mat& edges, int band_x,
+    int max_line_width, bool is_left, Point *ptop, Point *pbottom) {
+	assert(ptop);
+	assert(pbottom);
+	Rect band(band_x, 0, max_line_width, edges.rows);
+	band = band & Rect(0, 0, edges.cols, edges.rows);
+
+	Mat row_profile;
+	reduce(edges(band), row_profile, 1, CV_REDUCE_MAX);
+	row_profile = row_profile.t();
+	int top = FindProfileEdge(row_profile, 0, band.height, true);
+	int bottom = FindProfileEdge(row_profile, 0, band.height, false);
+	// the outermost column has edges, so the band is never empty
+	assert(top != -1 && bottom != -1);
+
+	Mat top_row = edges(band).row(top);
+	Mat bottom_row = edges(band).row(bottom);
+	*ptop = Point(band.x + FindProfileEdge(top_row, 0, band.width, is_left),
+	    top);
+	*pbottom = Point(band.x + FindProfileEdge(bottom_row, 0, band.width,
+	    is_left), bottom);
+}
+
+// Profile engine: tube sides are found from the column projection of the edge
+// map and labels corners are the extreme edge points in the same windows as
+// FindLableCorners uses
+static void FindCornersByProfiles(const Mat& edges,
+    const InspectionParams& params, object_corners_t *ptube,
+    object_corners_t *plable) {
+	assert(ptube);
+	assert(plable);
+	*ptube = object_corners_t();
+	*plable = object_corners_t();
+
+	Mat column_profile;
+	reduce(edges, column_profile, 0, CV_REDUCE_MAX);
+	int min_x = FindProfileEdge(column_profile, 0, edges.cols, true);
+	int max_x = FindProfileEdge(column_profile, 0, edges.cols, false);
+	if (min_x == -1)
+		return;
+
+	const int LINE_WIDTH = params.max_line_width;
+	FindTubeSideByProfiles(edges, min_x, LINE_WIDTH, true, &ptube->top_left,
+	    &ptube->bottom_left);
+	FindTubeSideByProfiles(edges, max_x - LINE_WIDTH + 1, LINE_WIDTH, false,
+	    &ptube->top_right, &ptube->bottom_right);
+
+	// tube sides are not a part of the label
+	Rect inside(min_x + LINE_WIDTH, 0, max_x - min_x + 1 - 2 * LINE_WIDTH,
+	    edges.rows);
+	if (inside.width <= 0)
+		return;
+
+	const object_corners_t &tube = *ptube;
+	const int MIN_LABEL_MARGIN = params.min_label_margin;
+	const int MAX_LABEL_MARGIN = params.max_label_margin;
+	const int MARGIN = MAX_LABEL_MARGIN - MIN_LABEL_MARGIN + 1;
+	plable->top_left = FindExtremeEdgePoint(edges, inside & Rect(
+	    tube.top_left.x + MIN_LABEL_MARGIN,
+	    tube.top_left.y + MIN_LABEL_MARGIN, MARGIN, MARGIN), true);
+	plable->bottom_left = FindExtremeEdgePoint(edges, inside & Rect(
+	    tube.bottom_left.x + MIN_LABEL_MARGIN,
+	    tube.bottom_left.y - MAX_LABEL_MARGIN, MARGIN, MARGIN), true);
+	plable->top_right = FindExtremeEdgePoint(edges, inside & Rect(
+	    tube.top_right.x - MAX_LABEL_MARGIN,
+	    tube.top_right.y + MIN_LABEL_MARGIN, MARGIN, MARGIN), false);
+	plable->bottom_right = FindExtremeEdgePoint(edges, inside & Rect(
+	    tube.bottom_right.x - MAX_LABEL_MARGIN,
+	    tube.bottom_right.y - MAX_LABEL_MARGIN, MARGIN, MARGIN), false);
+}
+
+void DrawFoundPoints(Mat mat, const object_corners_t &tube,
+    const object_corners_t &lable) {
+	circle(mat, tube.top_left, 1, Scalar(0,255,0));
+	circle(mat, tube.bottom_left, 1, Scalar(0,255,0));
+	circle(mat, lable.top_left, 1, Scalar(0,255,0));
+	circle(mat, lable.bottom_left, 1, Scalar(0,255,0));
+	circle(mat, tube.top_right, 1, Scalar(0,255,0));
+	circle(mat, tube.bottom_right, 1, Scalar(0,255,0));
+	circle(mat, lable.top_right, 1, Scalar(0,255,0));
+	circle(mat, lable.bottom_right, 1, Scalar(0,255,0));
+}
+
+void FindCorners(const Mat& edges, const vector<Point>& contour_points,
+    LocalizationEngine engine, const InspectionParams& params,
+    object_corners_t *ptube, object_corners_t *plable) {
+	assert(ptube);
+	assert(plable);
+	if (engine == LOCALIZATION_PROFILES) {
+		FindCornersByProfiles(edges, params, ptube, plable);
+		return;
+	}
+	PointIterator begin = contour_points.begin(), end = contour_points.end();
+	*ptube = FindTubeCorners(&begin, &end, params);
+	*plable = FindLableCorners(begin, end, *ptube, params);
+}
+
+test_result_t TestSingleBottle(const Mat& mat, LocalizationEngine engine,
+    const InspectionParams& params, object_corners_t *ptube,
+    object_corners_t *plable) {
+	Mat edges;
+	vector<Point> contour_points;
+	BlurStrip(mat, &edges);
+	FindEdges(edges, params, &edges);
+	if (engine == LOCALIZATION_CONTOURS)
+		FindContourPoints(edges, &contour_points);
+
+	object_corners_t tube, lable;
+	FindCorners(edges, contour_points, engine, params, &tube, &lable);
+	if (ptube)
+		*ptube = tube;
+	if (plable)
+		*plable = lable;
+	return TestCorners(tube, lable, params);
+}
+
+test_result_t TestCorners(const object_corners_t &tube,
+    const object_corners_t &lable, const InspectionParams& params) {
+	test_result_t result = {};
+	result.is_labeled = result.is_straight = result.is_centered = false;
+	const float ANGLE_EPS = params.angle_eps;
+	const int DISTANCE_EPS = params.distance_eps;
+
+	// lable exists if at least one corner point found
+	if ((lable.top_left.x    != 0 && lable.top_left.y     != 0) ||
+	    (lable.bottom_left.x != 0 && lable.bottom_left.y  != 0) ||
+	    (lable.top_right.x   != 0 && lable.top_right.y    != 0) ||
+	    (lable.bottom_left.x != 0 && lable.bottom_right.y != 0)) 
+		result.is_labeled = true;
+
+
+	// test if label is straight
+
+	// firsty if it has only left side
+	if ((lable.top_left.x     != 0 && lable.top_left.y      != 0) && 
+	    (lable.bottom_left.x  != 0 && lable.bottom_left.y   != 0) &&
+	    (lable.top_right.x    == 0 && lable.top_right.y    == 0) &&
+	    (lable.bottom_right.x == 0 && lable.bottom_right.y == 0)) {
+		float lable_angle = (float)
+		    (lable.top_left.x - lable.bottom_left.x) /
+		    (lable.top_left.y - lable.bottom_left.y);
+		float tube_angle = (float)
+		    (tube.top_left.x - tube.bottom_left.x) /
+		    (tube.top_left.y - tube.bottom_left.y);
+		if (fabs(lable_angle - tube_angle) < ANGLE_EPS) 
+			result.is_straight = true;
+	}
+	// secondly if it has only right side
+	if ((lable.top_right.x    != 0 && lable.top_right.y     != 0) && 
+	    (lable.bottom_right.x != 0 && lable.bottom_right.y  != 0) &&
+	    (lable.top_left.x     == 0 && lable.top_left.y      == 0) &&
+	    (lable.bottom_left.x  == 0 && lable.bottom_left.y   == 0)) {
+		float lable_angle = (float)
+		    (lable.top_right.x - lable.bottom_right.x) /
+		    (lable.top_right.y - lable.bottom_right.y);
+		float tube_angle = (float)
+		    (tube.top_right.x - tube.bottom_right.x) /
+		    (tube.top_right.y - tube.bottom_right.y);
+		if (fabs(lable_angle - tube_angle) < ANGLE_EPS) 
+			result.is_straight = true;
+	}
+	// and finally if it has both sides
+	if ((lable.top_right.x    != 0 && lable.top_right.y     != 0) && 
+	    (lable.bottom_right.x != 0 && lable.bottom_right.y  != 0) &&
+	    (lable.top_left.x     != 0 && lable.top_left.y      != 0) &&
+	    (lable.bottom_left.x  != 0 && lable.bottom_left.y   != 0)) {
+		float left_lable_angle = (float)
+		    (lable.top_left.x - lable.bottom_left.x);
+		float left_tube_angle = (float)
+		    (tube.top_left.x - tube.bottom_left.x);
+		float right_lable_angle = (float)
+		    (lable.top_right.x - lable.bottom_right.x);
+		float right_tube_angle = (float)
+		    (tube.top_right.x - tube.bottom_right.x);
+
+		if (fabs(left_lable_angle) < ANGLE_EPS &&
+		    fabs(right_lable_angle) < ANGLE_EPS) 
+			result.is_straight = true;
+		if (abs(lable.top_left.x - tube.top_left.x - 
+		    (tube.top_right.x - lable.top_right.x)) < DISTANCE_EPS && 
+		    abs(lable.bottom_left.x - tube.bottom_left.x - 
+		    (tube.bottom_right.x - lable.bottom_right.x)) <DISTANCE_EPS)  
+			result.is_centered = true;
+
+	}
+
+	return result;
+}
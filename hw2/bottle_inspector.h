@@ -0,0 +1,114 @@
+// Inspects a single bottle strip: finds the tube and label corners on the edge
+// map and tests whether the label exists, is straight and is centered. The
+// strip is read only, corner coordinates are relative to the strip, so a ROI
+// of the whole picture may be passed directly.
+
+#ifndef BOTTLE_INSPECTOR_H
+#define BOTTLE_INSPECTOR_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+// Default parameters of the inspection
+const int MAX_LINE_WIDTH = 5;
+const int MAX_LABEL_MARGIN = 20;
+const int MIN_LABEL_MARGIN = 1;
+const int DISTANCE_EPS = 4;
+const float ANGLE_EPS = 3;
+const double CANNY_LOW_THRESHOLD = 60;
+const double CANNY_HIGH_THRESHOLD = 100;
+
+// How the tube and label corners are found on the strip edge map
+enum LocalizationEngine {
+	LOCALIZATION_CONTOURS, // extreme points of the sorted contour points
+	LOCALIZATION_PROFILES  // first and last edges of the edge map projections
+};
+
+
+struct test_result_t {
+        bool operator ==(const test_result_t& tr) {
+		return is_labeled == tr.is_labeled && 
+		    is_centered == tr.is_centered && 
+		    is_straight == tr.is_straight;
+	}
+	bool is_labeled;
+	bool is_centered;
+	bool is_straight;
+};
+
+
+// structure to store for corner points of some rectangle object
+struct object_corners_t {
+	object_corners_t():
+	    top_left(cv::Point(0,0)),
+	    bottom_left(cv::Point(0,0)),
+	    top_right(cv::Point(0,0)),
+	    bottom_right(cv::Point(0,0)) {}
+
+	object_corners_t(cv::Point _tl, cv::Point _bl, cv::Point _tr,
+	    cv::Point _br):
+	    top_left(_tl),
+	    bottom_left(_bl),
+	    top_right(_tr),
+	    bottom_right(_br) {}
+
+	cv::Point top_left;
+	cv::Point bottom_left;
+	cv::Point top_right;
+	cv::Point bottom_right;
+};
+
+// Parameters of the inspection, the defaults are the constants above
+struct InspectionParams {
+	InspectionParams():
+		max_line_width (MAX_LINE_WIDTH),
+		min_label_margin (MIN_LABEL_MARGIN),
+		max_label_margin (MAX_LABEL_MARGIN),
+		distance_eps (DISTANCE_EPS),
+		angle_eps (ANGLE_EPS),
+		canny_low (CANNY_LOW_THRESHOLD),
+		canny_high (CANNY_HIGH_THRESHOLD) {}
+
+	int max_line_width;   // max width of the tube side on the edge map
+	int min_label_margin; // label corners are inside of the tube corners
+	int max_label_margin; // by this range of distances along both axes
+	int distance_eps;     // max difference of the centered label margins
+	float angle_eps;      // max slope difference of the straight label
+	double canny_low;
+	double canny_high;
+};
+
+// Tests the BGR strip with a single bottle, fills found corners if the
+// pointers are not NULL
+test_result_t TestSingleBottle(const cv::Mat& mat,
+    LocalizationEngine engine = LOCALIZATION_CONTOURS,
+    const InspectionParams& params = InspectionParams(),
+    object_corners_t *ptube = NULL, object_corners_t *plable = NULL);
+
+// Stages of TestSingleBottle. Every stage depends on the output of the
+// previous one and on its own parameters only, so its output may be reused
+// for all values of the parameters of the next stages.
+
+// Converts the BGR strip to the blurred gray picture
+void BlurStrip(const cv::Mat& strip, cv::Mat *pblurred);
+// Finds edges of the blurred strip by Canny with params thresholds
+void FindEdges(const cv::Mat& blurred, const InspectionParams& params,
+    cv::Mat *pedges);
+// Finds points of all contours of the edge map sorted by x (contours engine
+// only)
+void FindContourPoints(const cv::Mat& edges,
+    std::vector<cv::Point> *pcontour_points);
+// Finds tube and label corners using params line width and label margins
+void FindCorners(const cv::Mat& edges,
+    const std::vector<cv::Point>& contour_points, LocalizationEngine engine,
+    const InspectionParams& params, object_corners_t *ptube,
+    object_corners_t *plable);
+// Tests found corners using params angle and distance eps
+test_result_t TestCorners(const object_corners_t &tube,
+    const object_corners_t &lable, const InspectionParams& params);
+
+// Draws found corner points on the strip to illustrate the algorithm
+void DrawFoundPoints(cv::Mat mat, const object_corners_t &tube,
+    const object_corners_t &lable);
+
+#endif // BOTTLE_INSPECTOR_H
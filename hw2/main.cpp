@@ -5,292 +5,66 @@
 #include <stdio.h>
 #include <string>
 #include <vector>
-#include <set>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+
+#include "bottle_inspector.h"
+#include "image_pack.h"
+#include "parameter_sweep.h"
 
 using std::string;
-using std::multiset;
 using std::vector;
 using std::ifstream;
 using std::ofstream;
+using std::istringstream;
 using namespace cv;
 
 const size_t BOTTLES_COUNT = 5;
-const int MAX_LINE_WIDTH = 5;
-const int MAX_LABEL_MARGIN = 20;
-const int MIN_LABEL_MARGIN = 1;
-const int DISTANCE_EPS = 4;
-const float ANGLE_EPS = 3;
-
 
-struct test_result_t {
-        bool operator ==(const test_result_t& tr) {
-		return is_labeled == tr.is_labeled && 
-		    is_centered == tr.is_centered && 
-		    is_straight == tr.is_straight;
-	}
-	bool is_labeled;
-	bool is_centered;
-	bool is_straight;
+struct performance_metrics_t {
+	float accuracy;
+	float precision;
+	float recall;
 };
 
-
-// structure to store for corner points of some rectangle object
-struct object_corners_t {
-	object_corners_t():
-	    top_left(Point(0,0)),
-	    bottom_left(Point(0,0)),
-	    top_right(Point(0,0)),
-	    bottom_right(Point(0,0)) {}
-
-	object_corners_t(Point _tl, Point _bl, Point _tr, Point _br):
-	    top_left(_tl),
-	    bottom_left(_bl),
-	    top_right(_tr),
-	    bottom_right(_br) {}
-
-	Point top_left;
-	Point bottom_left;
-	Point top_right;
-	Point bottom_right;
-};
-
-bool ComparePointsByXCoord(const Point& p1, const Point& p2) {
-	return p1.x < p2.x;
-}
-
-bool ComparePointsByYCoord(const Point& p1, const Point& p2) {
-	return p1.y < p2.y;
-}
-
-typedef bool (*ComparePointsT) (const Point& p1, const Point& p2);
-
-// This function performs Canny algorithm to detect edges aand next uses
-// findContours to find all contours on the picture
-void FindContourPoints(const Mat& mat,
-    multiset<Point, ComparePointsT>* pcontour_points) {
-	assert(pcontour_points);
-
-	Mat tmp_img;
-	cvtColor(mat, tmp_img, CV_BGR2GRAY);
-	blur(tmp_img, tmp_img, Size(4,4));
-	Canny(tmp_img, tmp_img, 60, 100, 3);
-
-	vector<vector<Point> > contours;
-	vector<Vec4i> hierarchy;
-
-	findContours(tmp_img, contours, hierarchy, CV_RETR_TREE, 
-	    CV_CHAIN_APPROX_SIMPLE, Point(0, 0));
-
-	for (int i = 0; i < contours.size(); i++) 
-		for (Point p : contours[i]) 
-			pcontour_points->insert(p);
-
-}
-
-object_corners_t FindTubeCorners(
-    multiset<Point, ComparePointsT>* pcontour_points) {
-
-	multiset<Point, ComparePointsT> left_tube_side(ComparePointsByYCoord);
-	multiset<Point, ComparePointsT> right_tube_side(ComparePointsByYCoord);
-
-	// Find left tube side as top left points
-	int min_x = pcontour_points->begin()->x;
-	while (pcontour_points->begin()->x - min_x < MAX_LINE_WIDTH) {		
-		left_tube_side.insert(*(pcontour_points->begin()));
-		pcontour_points->erase(pcontour_points->begin());
-	}
-
-	// Find right tube side as top left points
-	int max_x = (--pcontour_points->end())->x;
-	while (max_x - (--pcontour_points->end())->x < MAX_LINE_WIDTH) {		
-		right_tube_side.insert(*(--pcontour_points->end()));
-		pcontour_points->erase(--pcontour_points->end());
-	} 
-
-	// As multisets sort points by the Y coord, the top point is set::begin 
-	// bottom point is set::end()
-	return object_corners_t(
-	    *left_tube_side.begin(),  *(--left_tube_side.end()),
-	    *right_tube_side.begin(), *(--right_tube_side.end()));
-}
-
-object_corners_t FindLableCorners(
-    const multiset<Point, ComparePointsT> &contour_points, 
-    const object_corners_t &tube) {
-	// find label using approach that distance to lable from each side is
-	// bigger than MIN_LABEL_MARGIN and smaller than MAX_LABEL_MARGIN
-
-	object_corners_t lable;
-
-	// Find top left
-	for (auto i = contour_points.begin(); i != contour_points.end(); ++i) {
-		if ((i->y - tube.top_left.y < MIN_LABEL_MARGIN) ||
-		    (i->y - tube.top_left.y > MAX_LABEL_MARGIN))
-			continue;
-		if (i->x - tube.top_left.x < MIN_LABEL_MARGIN) 
-			continue;
-		if (i->x - tube.top_left.x > MAX_LABEL_MARGIN)
-			break;
-	
-		lable.top_left = *i;	
-		break;
-
-	}
-
-	// Find bottom left
-	for (auto i = contour_points.begin(); i != contour_points.end(); ++i) {
-		if ((tube.bottom_left.y - i->y < MIN_LABEL_MARGIN) ||
-		    (tube.bottom_left.y - i->y > MAX_LABEL_MARGIN))
-			continue;
-		if (i->x - tube.bottom_left.x < MIN_LABEL_MARGIN) 
-			continue;
-		if (i->x - tube.bottom_left.x > MAX_LABEL_MARGIN)
-			break;
-		lable.bottom_left = *i;	
-		break;
-	}
-
-	// Find top right 
-	for (auto i = contour_points.rbegin(); i != contour_points.rend(); ++i){
-		if ((i->y - tube.top_right.y < MIN_LABEL_MARGIN) ||
-		    (i->y - tube.top_right.y > MAX_LABEL_MARGIN))
-			continue;
-		if (tube.top_right.x - i->x < MIN_LABEL_MARGIN) 
-			continue;
-		if (tube.top_right.x - i->x > MAX_LABEL_MARGIN)
-			break;
-
-		lable.top_right = *i;	
-		break;
-	}
-
-	// Find bottom right 
-	for (auto i = contour_points.rbegin(); i != contour_points.rend(); ++i){
-		if ((tube.bottom_right.y - i->y < MIN_LABEL_MARGIN) ||
-		    (tube.bottom_right.y - i->y > MAX_LABEL_MARGIN))
-			continue;
-		if (tube.bottom_right.x - i->x < MIN_LABEL_MARGIN) 
-			continue;
-		if (tube.bottom_right.x - i->x > MAX_LABEL_MARGIN)
-			break;
-	
-		lable.bottom_right = *i;	
-		break;
-	}
-
-	return lable;
-}
-
-// simple draw corner points to illustrate an algorithm
-void DrawFoundPoints(Mat mat, const object_corners_t &tube, 
-    const object_corners_t &lable) {
-	static int i = 0;
-	circle(mat, tube.top_left, 1, Scalar(0,255,0));
-	circle(mat, tube.bottom_left, 1, Scalar(0,255,0));
-	circle(mat, lable.top_left, 1, Scalar(0,255,0));
-	circle(mat, lable.bottom_left, 1, Scalar(0,255,0));
-	circle(mat, tube.top_right, 1, Scalar(0,255,0));
-	circle(mat, tube.bottom_right, 1, Scalar(0,255,0));
-	circle(mat, lable.top_right, 1, Scalar(0,255,0));
-	circle(mat, lable.bottom_right, 1, Scalar(0,255,0));
-
-	char win_name[100] = {0};
-	sprintf(win_name, "%d", i++);
-	namedWindow(win_name, 0);
-	imshow(win_name, mat);
-}
-
-test_result_t TestSingleBottle(Mat mat) {
-	test_result_t result = {};
-	result.is_labeled = result.is_straight = result.is_centered = false;
-	
-	multiset<Point, ComparePointsT> contour_points(ComparePointsByXCoord);
-	FindContourPoints(mat, &contour_points);
-	object_corners_t tube = FindTubeCorners(&contour_points);
-	object_corners_t lable = FindLableCorners(contour_points, tube);
-	//DrawFoundPoints(mat, tube, lable);
-
-	// lable exists if at least one corner point found
-	if ((lable.top_left.x    != 0 && lable.top_left.y     != 0) ||
-	    (lable.bottom_left.x != 0 && lable.bottom_left.y  != 0) ||
-	    (lable.top_right.x   != 0 && lable.top_right.y    != 0) ||
-	    (lable.bottom_left.x != 0 && lable.bottom_right.y != 0)) 
-		result.is_labeled = true;
-
-
-	// test if label is straight
-
-	// firsty if it has only left side
-	if ((lable.top_left.x     != 0 && lable.top_left.y      != 0) && 
-	    (lable.bottom_left.x  != 0 && lable.bottom_left.y   != 0) &&
-	    (lable.top_right.x    == 0 && lable.top_right.y    == 0) &&
-	    (lable.bottom_right.x == 0 && lable.bottom_right.y == 0)) {
-		float lable_angle = (float)
-		    (lable.top_left.x - lable.bottom_left.x) /
-		    (lable.top_left.y - lable.bottom_left.y);
-		float tube_angle = (float)
-		    (tube.top_left.x - tube.bottom_left.x) /
-		    (tube.top_left.y - tube.bottom_left.y);
-		if (fabs(lable_angle - tube_angle) < ANGLE_EPS) 
-			result.is_straight = true;
-	}
-	// secondly if it has only right side
-	if ((lable.top_right.x    != 0 && lable.top_right.y     != 0) && 
-	    (lable.bottom_right.x != 0 && lable.bottom_right.y  != 0) &&
-	    (lable.top_left.x     == 0 && lable.top_left.y      == 0) &&
-	    (lable.bottom_left.x  == 0 && lable.bottom_left.y   == 0)) {
-		float lable_angle = (float)
-		    (lable.top_right.x - lable.bottom_right.x) /
-		    (lable.top_right.y - lable.bottom_right.y);
-		float tube_angle = (float)
-		    (tube.top_right.x - tube.bottom_right.x) /
-		    (tube.top_right.y - tube.bottom_right.y);
-		if (fabs(lable_angle - tube_angle) < ANGLE_EPS) 
-			result.is_straight = true;
-	}
-	// and finally if it has both sides
-	if ((lable.top_right.x    != 0 && lable.top_right.y     != 0) && 
-	    (lable.bottom_right.x != 0 && lable.bottom_right.y  != 0) &&
-	    (lable.top_left.x     != 0 && lable.top_left.y      != 0) &&
-	    (lable.bottom_left.x  != 0 && lable.bottom_left.y   != 0)) {
-		float left_lable_angle = (float)
-		    (lable.top_left.x - lable.bottom_left.x);
-		float left_tube_angle = (float)
-		    (tube.top_left.x - tube.bottom_left.x);
-		float right_lable_angle = (float)
-		    (lable.top_right.x - lable.bottom_right.x);
-		float right_tube_angle = (float)
-		    (tube.top_right.x - tube.bottom_right.x);
-
-		if (fabs(left_lable_angle) < ANGLE_EPS &&
-		    fabs(right_lable_angle) < ANGLE_EPS) 
-			result.is_straight = true;
-		if (abs(lable.top_left.x - tube.top_left.x - 
-		    (tube.top_right.x - lable.top_right.x)) < DISTANCE_EPS && 
-		    abs(lable.bottom_left.x - tube.bottom_left.x - 
-		    (tube.bottom_right.x - lable.bottom_right.x)) <DISTANCE_EPS)  
-			result.is_centered = true;
-
-	}
-
-	return result;
-}
-
-bool TestImageWithBottles(const string& file_name, 
-    vector<test_result_t> *presult) {
+// Tests all bottles of the image and adds the time spent on the strips to
+// *pstrips_seconds. If is_show, found points of every strip are shown in the
+// window named by the image and the strip number.
+bool TestImageWithBottles(const ImagePack& pack, const string& file_name, 
+    LocalizationEngine engine, bool is_show, vector<test_result_t> *presult,
+    double *pstrips_seconds) {
 	assert(presult);
+	assert(pstrips_seconds);
 
-	Mat img = imread(file_name.c_str(), CV_LOAD_IMAGE_COLOR);
+	Mat img = pack.LoadImage(file_name);
 	size_t width = img.cols / BOTTLES_COUNT;
 	if (!img.data)
 		return false;
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	vector<object_corners_t> tubes(BOTTLES_COUNT), lables(BOTTLES_COUNT);
 	for (size_t i = 0; i < BOTTLES_COUNT; ++i) 
-		presult->push_back(
-		    TestSingleBottle(img(Rect(i * width, 0, width, img.rows))));
+		presult->push_back(TestSingleBottle(
+		    img(Rect(i * width, 0, width, img.rows)), engine,
+		    InspectionParams(), &tubes[i], &lables[i]));
+	*pstrips_seconds += std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start).count();
+
+	for (size_t i = 0; is_show && i < BOTTLES_COUNT; ++i) {
+		Mat strip = img(Rect(i * width, 0, width, img.rows)).clone();
+		DrawFoundPoints(strip, tubes[i], lables[i]);
+		std::ostringstream win_name;
+		win_name << file_name << ":" << i;
+		namedWindow(win_name.str(), 0);
+		imshow(win_name.str(), strip);
+	}
 	return true;	
 }
 
-void ComputePerformanceMetrics(const vector<test_result_t> &answers,
+performance_metrics_t ComputePerformanceMetrics(
+    const vector<test_result_t> &answers,
     const vector<test_result_t> &result) {
 	// Macros here because we need to produce the sae calcuations for each 
 	// struct field
@@ -327,21 +101,166 @@ void ComputePerformanceMetrics(const vector<test_result_t> &answers,
 	float recall =  (float) (tp_is_labeled + tp_is_straight + 
 	    tp_is_centered) / (tp_is_labeled + fn_is_labeled +
 	    tp_is_straight + fn_is_straight + tp_is_centered + fn_is_centered);
+	performance_metrics_t metrics = {accuracy, precision, recall};
+	return metrics;
+}
+
+void PrintPerformanceMetrics(const performance_metrics_t &metrics) {
 	printf("Average quality metrics: accuracy = %f, precision = %f,"
-	    "recall = %f", accuracy, precision, recall);
+	    "recall = %f", metrics.accuracy, metrics.precision, metrics.recall);
+}
+
+// Reads the sweep grid: lines of the parameter name followed by its values.
+// Names are the InspectionParams field names, parameters which are not
+// listed keep the default value.
+bool ReadSweepGrid(const string& file_name, SweepGrid *pgrid) {
+	assert(pgrid);
+	ifstream fin(file_name.c_str());
+	if (!fin.is_open())
+		return false;
+
+	string line;
+	while (std::getline(fin, line)) {
+		istringstream sin(line);
+		string name;
+		if (!(sin >> name))
+			continue;
+		vector<double> values;
+		double value = 0;
+		while (sin >> value)
+			values.push_back(value);
+		if (values.empty())
+			return false;
+
+		if (name == "max_line_width")
+			pgrid->max_line_widths.assign(values.begin(), values.end());
+		else if (name == "min_label_margin")
+			pgrid->min_label_margins.assign(values.begin(), values.end());
+		else if (name == "max_label_margin")
+			pgrid->max_label_margins.assign(values.begin(), values.end());
+		else if (name == "distance_eps")
+			pgrid->distance_epss.assign(values.begin(), values.end());
+		else if (name == "angle_eps")
+			pgrid->angle_epss.assign(values.begin(), values.end());
+		else if (name == "canny_low")
+			pgrid->canny_lows.assign(values.begin(), values.end());
+		else if (name == "canny_high")
+			pgrid->canny_highs.assign(values.begin(), values.end());
+		else
+			return false;
+	}
+	return true;
+}
+
+// Tells whether the first metrics are not worse in all of the three and
+// better in some of them
+bool IsDominating(const performance_metrics_t &metrics1,
+    const performance_metrics_t &metrics2) {
+	return metrics1.accuracy >= metrics2.accuracy &&
+	    metrics1.precision >= metrics2.precision &&
+	    metrics1.recall >= metrics2.recall &&
+	    (metrics1.accuracy > metrics2.accuracy ||
+	    metrics1.precision > metrics2.precision ||
+	    metrics1.recall > metrics2.recall);
+}
+
+// Tells whether all three metrics are equal
+bool IsSameMetrics(const performance_metrics_t &metrics1,
+    const performance_metrics_t &metrics2) {
+	return metrics1.accuracy == metrics2.accuracy &&
+	    metrics1.precision == metrics2.precision &&
+	    metrics1.recall == metrics2.recall;
+}
+
+// Evaluates the grid on all strips of the test images and prints grid points
+// of the accuracy/precision/recall front (not dominated by any other point)
+// and the sweep throughput. Of the front points with the same metrics only
+// the first one is printed with the count of the others.
+bool RunSweep(const ImagePack& pack, const vector<string> &files,
+    const vector<test_result_t> &answers, const SweepGrid &sweep_grid,
+    LocalizationEngine engine, unsigned int threads_count) {
+	// decoded images are kept while the sweep references their strips
+	vector<Mat> images;
+	ParameterSweep sweep(engine, threads_count);
+	for (const string& file_name : files) {
+		Mat img = pack.LoadImage(file_name);
+		if (!img.data)
+			return false;
+		images.push_back(img);
+		size_t width = img.cols / BOTTLES_COUNT;
+		for (size_t i = 0; i < BOTTLES_COUNT; ++i)
+			sweep.AddStrip(img(Rect(i * width, 0, width, img.rows)));
+	}
+
+	vector<InspectionParams> grid;
+	sweep_grid.Expand(&grid);
+	vector<vector<test_result_t> > results;
+	SweepStats stats;
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	sweep.Run(grid, &results, &stats);
+	double seconds = std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start).count();
+
+	vector<performance_metrics_t> metrics;
+	for (const vector<test_result_t> &result : results)
+		metrics.push_back(ComputePerformanceMetrics(answers, result));
+	vector<size_t> front;
+	for (size_t i = 0; i < grid.size(); i++) {
+		bool is_dominated = false;
+		for (size_t j = 0; j < grid.size() && !is_dominated; j++)
+			is_dominated = IsDominating(metrics[j], metrics[i]);
+		if (!is_dominated)
+			front.push_back(i);
+	}
+	vector<char> is_tied(front.size(), false);
+	for (size_t k = 0; k < front.size(); k++) {
+		if (is_tied[k])
+			continue;
+		size_t ties_count = 0;
+		for (size_t l = k + 1; l < front.size(); l++)
+			if (IsSameMetrics(metrics[front[k]], metrics[front[l]])) {
+				is_tied[l] = true;
+				ties_count++;
+			}
+		const InspectionParams &params = grid[front[k]];
+		printf("max_line_width %d, label_margin %d..%d, distance_eps %d, "
+		    "angle_eps %g, canny %g/%g: ", params.max_line_width,
+		    params.min_label_margin, params.max_label_margin,
+		    params.distance_eps, params.angle_eps, params.canny_low,
+		    params.canny_high);
+		PrintPerformanceMetrics(metrics[front[k]]);
+		if (ties_count > 0)
+			printf(" (and %zu more points with the same metrics)",
+			    ties_count);
+		printf("\n");
+	}
+
+	printf("%zu grid points x %zu strips in %.3f s (%.0f strip tests/s, "
+	    "%u threads): blur %.3f s, %zu edge maps %.3f s, %zu corner sets "
+	    "%.3f s, tests %.3f s\n", grid.size(), sweep.StripsCount(),
+	    seconds, grid.size() * sweep.StripsCount() / std::max(seconds, 1e-9),
+	    threads_count, stats.blur_seconds, stats.edge_maps,
+	    stats.edges_seconds, stats.corner_sets, stats.corners_seconds,
+	    stats.tests_seconds);
+	return true;
 }
  
 
-bool ReadTestFile(const string& file_name, 
+// file_name is either the test file or the pack made from it, in the last
+// case the pack is opened to load pictures from
+bool ReadTestFile(const string& file_name, ImagePack *ppack,
    vector<test_result_t> *panswers, vector<string> *ppictures) {
+	assert(ppack);
 	assert(panswers);
 	assert(ppictures);
 	ppictures->clear();
 	panswers->clear();
 
-	ifstream fin(file_name.c_str()); 
-	if (!fin.is_open())
+	string list;
+	if (!ppack->ReadList(file_name, &list))
 		return false;
+	istringstream fin(list);
 
 	while (!fin.eof()) {
 		string tmp_name;
@@ -384,19 +303,84 @@ int main(int argc, char** argv) {
 	vector<test_result_t> true_res;
 	vector<test_result_t> computed_res;
 	vector<string> files;
+	ImagePack pack;
+	string test_file = "test.txt";
+	vector<LocalizationEngine> engines(1, LOCALIZATION_CONTOURS);
+	// the default run prints the metrics only, as before the engines
+	bool is_engine_chosen = false;
+	bool is_show = false;
+	string sweep_file;
+	unsigned int threads_count = std::max(std::thread::hardware_concurrency(),
+	    1u);
+
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--profiles") {
+			engines.assign(1, LOCALIZATION_PROFILES);
+			is_engine_chosen = true;
+		}
+		else if (arg == "--show")
+			is_show = true;
+		else if (arg == "--sweep" && i + 1 < argc)
+			sweep_file = argv[++i];
+		else if (arg == "--threads" && i + 1 < argc)
+			threads_count = std::max(atoi(argv[++i]), 1);
+		else if (arg == "--compare-engines") {
+			engines.assign(1, LOCALIZATION_CONTOURS);
+			engines.push_back(LOCALIZATION_PROFILES);
+			is_engine_chosen = true;
+		}
+		else
+			test_file = arg;
+	}
 
-	if (!ReadTestFile("test.txt", &true_res, &files)) {
+	if (!ReadTestFile(test_file, &pack, &true_res, &files)) {
 		fprintf(stderr, "Invalid test file name or format\n");
 		return -1;
 	}
 
-	for (string& file_name : files)
-		if (!TestImageWithBottles(file_name, &computed_res)) {
-			fprintf(stderr, "Invalid image file name in test\n");
+	if (sweep_file.length() > 0) {
+		SweepGrid sweep_grid;
+		if (!ReadSweepGrid(sweep_file, &sweep_grid)) {
+			fprintf(stderr, "Invalid sweep grid file name or format\n");
 			return -1;
 		}
-	ComputePerformanceMetrics(true_res, computed_res);	
-waitKey(0);
+		for (LocalizationEngine engine : engines) {
+			printf("%s sweep:\n", engine == LOCALIZATION_PROFILES ?
+			    "profiles" : "contours");
+			if (!RunSweep(pack, files, true_res, sweep_grid, engine,
+			    threads_count)) {
+				fprintf(stderr, "Invalid image file name in test\n");
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	for (LocalizationEngine engine : engines) {
+		double strips_seconds = 0;
+		computed_res.clear();
+		for (string& file_name : files)
+			if (!TestImageWithBottles(pack, file_name, engine,
+			    is_show, &computed_res, &strips_seconds)) {
+				fprintf(stderr, "Invalid image file name in test\n");
+				return -1;
+			}
+		performance_metrics_t metrics = ComputePerformanceMetrics(true_res,
+		    computed_res);
+		if (!is_engine_chosen) {
+			PrintPerformanceMetrics(metrics);
+			printf("\n");
+			continue;
+		}
+		printf("%s: ", engine == LOCALIZATION_PROFILES ?
+		    "profiles" : "contours");
+		PrintPerformanceMetrics(metrics);
+		printf(", time per strip = %f ms\n",
+		    1000 * strips_seconds / std::max<size_t>(computed_res.size(), 1));
+	}
+	if (is_show)
+		waitKey(0);
 		
 	return 0;
 }
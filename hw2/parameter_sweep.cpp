@@ -0,0 +1,172 @@
+#include "parameter_sweep.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+
+using std::vector;
+using namespace cv;
+
+// Calls body for every index in [0, count) by threads_count threads, indices
+// are taken one by one, so uneven tasks are balanced
+static void ParallelFor(size_t count, unsigned int threads_count,
+    const std::function<void (size_t)>& body) {
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++)
+			body(i);
+	};
+	vector<std::thread> threads;
+	for (unsigned int i = 1; i < threads_count && i < count; i++)
+		threads.push_back(std::thread(worker));
+	worker();
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start).count();
+}
+
+// Grid points with the same corner finding parameters share found corners
+static bool IsSameGeometry(const InspectionParams& params1,
+    const InspectionParams& params2) {
+	return params1.canny_low == params2.canny_low &&
+	    params1.canny_high == params2.canny_high &&
+	    params1.max_line_width == params2.max_line_width &&
+	    params1.min_label_margin == params2.min_label_margin &&
+	    params1.max_label_margin == params2.max_label_margin;
+}
+
+SweepGrid::SweepGrid():
+	max_line_widths (1, MAX_LINE_WIDTH),
+	min_label_margins (1, MIN_LABEL_MARGIN),
+	max_label_margins (1, MAX_LABEL_MARGIN),
+	distance_epss (1, DISTANCE_EPS),
+	angle_epss (1, ANGLE_EPS),
+	canny_lows (1, CANNY_LOW_THRESHOLD),
+	canny_highs (1, CANNY_HIGH_THRESHOLD) {}
+
+void SweepGrid::Expand(vector<InspectionParams> *pgrid) const {
+	assert(pgrid);
+	pgrid->clear();
+	// the innermost loops are over the parameters of the last stages, so
+	// grid points sharing the corners are neighbours
+	InspectionParams params;
+	for (double canny_low : canny_lows)
+	for (double canny_high : canny_highs) {
+		if (canny_low > canny_high)
+			continue;
+		params.canny_low = canny_low;
+		params.canny_high = canny_high;
+		for (int max_line_width : max_line_widths)
+		for (int min_label_margin : min_label_margins)
+		for (int max_label_margin : max_label_margins) {
+			if (min_label_margin > max_label_margin)
+				continue;
+			params.max_line_width = max_line_width;
+			params.min_label_margin = min_label_margin;
+			params.max_label_margin = max_label_margin;
+			for (int distance_eps : distance_epss)
+			for (float angle_eps : angle_epss) {
+				params.distance_eps = distance_eps;
+				params.angle_eps = angle_eps;
+				pgrid->push_back(params);
+			}
+		}
+	}
+}
+
+ParameterSweep::ParameterSweep(LocalizationEngine engine,
+    unsigned int threads_count):
+	engine_ (engine),
+	threads_count_ (std::max(threads_count, 1u)) {}
+
+void ParameterSweep::AddStrip(const Mat& strip) {
+	strips_.push_back(strip);
+}
+
+void ParameterSweep::Run(const vector<InspectionParams>& grid,
+    vector<vector<test_result_t> > *presults, SweepStats *pstats) {
+	assert(presults);
+	SweepStats stats;
+	const size_t STRIPS = strips_.size();
+
+	// blurred strips are shared by all grid points
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	size_t blurred_count = blurred_.size();
+	blurred_.resize(STRIPS);
+	ParallelFor(STRIPS - blurred_count, threads_count_, [&](size_t i) {
+		BlurStrip(strips_[blurred_count + i], &blurred_[blurred_count + i]);
+	});
+	stats.blur_seconds = SecondsSince(start);
+
+	// edge maps and contour points of the new thresholds, strips added since
+	// the previous run are not cached for the old ones either
+	start = std::chrono::steady_clock::now();
+	// the cache is not modified by the workers, they only fill its entries
+	vector<std::pair<CannyThresholds, size_t> > edge_tasks;
+	for (const InspectionParams& params : grid) {
+		CannyThresholds thresholds(params.canny_low, params.canny_high);
+		vector<StripEdges> &strip_edges = edges_[thresholds];
+		for (size_t i = strip_edges.size(); i < STRIPS; i++)
+			edge_tasks.push_back(std::make_pair(thresholds, i));
+		strip_edges.resize(STRIPS);
+	}
+	ParallelFor(edge_tasks.size(), threads_count_, [&](size_t task) {
+		const CannyThresholds &thresholds = edge_tasks[task].first;
+		size_t i = edge_tasks[task].second;
+		StripEdges &strip_edges = edges_.find(thresholds)->second[i];
+		InspectionParams params;
+		params.canny_low = thresholds.first;
+		params.canny_high = thresholds.second;
+		FindEdges(blurred_[i], params, &strip_edges.edges);
+		if (engine_ == LOCALIZATION_CONTOURS)
+			FindContourPoints(strip_edges.edges,
+			    &strip_edges.contour_points);
+	});
+	stats.edge_maps = edge_tasks.size();
+	stats.edges_seconds = SecondsSince(start);
+
+	// corners of every distinct geometry, Expand makes the grid points
+	// sharing it neighbours
+	start = std::chrono::steady_clock::now();
+	vector<size_t> geometry_of_point(grid.size());
+	vector<size_t> geometry_points;
+	for (size_t i = 0; i < grid.size(); i++) {
+		if (geometry_points.empty() ||
+		    !IsSameGeometry(grid[geometry_points.back()], grid[i]))
+			geometry_points.push_back(i);
+		geometry_of_point[i] = geometry_points.size() - 1;
+	}
+	vector<object_corners_t> tubes(geometry_points.size() * STRIPS);
+	vector<object_corners_t> lables(geometry_points.size() * STRIPS);
+	ParallelFor(tubes.size(), threads_count_, [&](size_t task) {
+		const InspectionParams &params = grid[geometry_points[task / STRIPS]];
+		size_t i = task % STRIPS;
+		const StripEdges &strip_edges = edges_.find(CannyThresholds(
+		    params.canny_low, params.canny_high))->second[i];
+		FindCorners(strip_edges.edges, strip_edges.contour_points, engine_,
+		    params, &tubes[task], &lables[task]);
+	});
+	stats.corner_sets = geometry_points.size();
+	stats.corners_seconds = SecondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	presults->assign(grid.size(), vector<test_result_t>(STRIPS));
+	ParallelFor(grid.size(), threads_count_, [&](size_t point) {
+		size_t first = geometry_of_point[point] * STRIPS;
+		for (size_t i = 0; i < STRIPS; i++)
+			(*presults)[point][i] = TestCorners(tubes[first + i],
+			    lables[first + i], grid[point]);
+	});
+	stats.tests_seconds = SecondsSince(start);
+
+	if (pstats)
+		*pstats = stats;
+}
@@ -0,0 +1,83 @@
+// Parameter sweep of the bottle inspection. Every combination of the grid
+// values is evaluated on all strips. Outputs of the inspection stages are
+// cached and shared by the grid points: blurred strips by all of them, edge
+// maps and contour points by the points with the same Canny thresholds,
+// corners by the points with the same thresholds, line width and margins.
+// Every stage is computed by several threads.
+
+#ifndef PARAMETER_SWEEP_H
+#define PARAMETER_SWEEP_H
+
+#include <opencv2/core/core.hpp>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "bottle_inspector.h"
+
+// Values of every parameter, a single default value if not set
+struct SweepGrid {
+	SweepGrid();
+
+	// Makes the parameters of every grid point
+	void Expand(std::vector<InspectionParams> *pgrid) const;
+
+	std::vector<int> max_line_widths;
+	std::vector<int> min_label_margins;
+	std::vector<int> max_label_margins;
+	std::vector<int> distance_epss;
+	std::vector<float> angle_epss;
+	std::vector<double> canny_lows;
+	std::vector<double> canny_highs;
+};
+
+// Time spent on every stage of the last Run
+struct SweepStats {
+	SweepStats():
+		blur_seconds (0),
+		edges_seconds (0),
+		corners_seconds (0),
+		tests_seconds (0),
+		edge_maps (0),
+		corner_sets (0) {}
+
+	double blur_seconds;
+	double edges_seconds;   // edge maps and contour points
+	double corners_seconds;
+	double tests_seconds;
+	size_t edge_maps;       // count of computed (not cached) edge maps
+	size_t corner_sets;     // count of distinct corner finding parameters
+};
+
+class ParameterSweep {
+public:
+	ParameterSweep(LocalizationEngine engine, unsigned int threads_count);
+
+	// Adds the BGR strip with a single bottle. Strip data is referenced,
+	// not copied, and must be valid while the sweep is used.
+	void AddStrip(const cv::Mat& strip);
+	size_t StripsCount() const { return strips_.size(); }
+
+	// Evaluates every grid point on all strips, (*presults)[i][j] is the
+	// result of the grid point i on the strip j. Cached stages are kept for
+	// the next runs.
+	void Run(const std::vector<InspectionParams>& grid,
+	    std::vector<std::vector<test_result_t> > *presults,
+	    SweepStats *pstats = NULL);
+
+private:
+	typedef std::pair<double, double> CannyThresholds;
+
+	struct StripEdges {
+		cv::Mat edges;
+		std::vector<cv::Point> contour_points;
+	};
+
+	LocalizationEngine engine_;
+	unsigned int threads_count_;
+	std::vector<cv::Mat> strips_;
+	std::vector<cv::Mat> blurred_;
+	std::map<CannyThresholds, std::vector<StripEdges> > edges_;
+};
+
+#endif // PARAMETER_SWEEP_H
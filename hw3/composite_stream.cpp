@@ -0,0 +1,145 @@
+#include "composite_stream.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+using std::string;
+using std::vector;
+using namespace cv;
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start).count();
+}
+
+static size_t PictureBytes(const Mat& picture) {
+	return picture.total() * picture.elemSize();
+}
+
+CompositeStream::CompositeStream():
+	prefetch_count_ (1),
+	memory_budget_ (0),
+	buffered_bytes_ (0),
+	peak_buffered_bytes_ (0),
+	is_loader_done_ (true),
+	is_closing_ (false),
+	is_failed_ (false),
+	wait_seconds_ (0),
+	load_seconds_ (0) {}
+
+CompositeStream::~CompositeStream() {
+	Close();
+}
+
+bool CompositeStream::Open(const string& file_name, size_t prefetch_count,
+    size_t memory_budget) {
+	Close();
+	string list;
+	if (!pack_.ReadList(file_name, &list))
+		return false;
+	std::istringstream fin(list);
+
+	composites_.clear();
+	while (!fin.eof()) {
+		Composite composite;
+		fin >> composite.file_name;
+		if (composite.file_name.length() == 0)
+			break;
+		size_t sign_candidates_count = 0;
+		fin >> sign_candidates_count;
+		for (size_t i = 0; i < sign_candidates_count; i++) {
+			string tmp_sign_name;
+			fin >> tmp_sign_name;
+			composite.sign_names.push_back(tmp_sign_name);
+		}
+		composites_.push_back(composite);
+	}
+
+	prefetch_count_ = std::max<size_t>(prefetch_count, 1);
+	memory_budget_ = memory_budget;
+	buffered_bytes_ = peak_buffered_bytes_ = 0;
+	is_loader_done_ = is_closing_ = is_failed_ = false;
+	wait_seconds_ = load_seconds_ = 0;
+	loader_ = std::thread(&CompositeStream::LoaderLoop, this);
+	return true;
+}
+
+void CompositeStream::LoaderLoop() {
+	for (size_t i = 0; i < composites_.size(); i++) {
+		{
+			// the next picture is loaded when it fits into the prefetch
+			// window
+			std::unique_lock<std::mutex> lock(mutex_);
+			taken_condition_.wait(lock, [this]() {
+				return is_closing_ || loaded_.size() < prefetch_count_;
+			});
+			if (is_closing_)
+				break;
+		}
+
+		std::chrono::steady_clock::time_point start =
+		    std::chrono::steady_clock::now();
+		Composite composite = composites_[i];
+		composite.picture = pack_.LoadImage(composite.file_name);
+		double seconds = SecondsSince(start);
+
+		std::unique_lock<std::mutex> lock(mutex_);
+		load_seconds_ += seconds;
+		if (!composite.picture.data) {
+			is_failed_ = true;
+			break;
+		}
+		// the size is known only after decoding, so the decoded picture
+		// waits here for room in the budget
+		size_t bytes = PictureBytes(composite.picture);
+		taken_condition_.wait(lock, [this, bytes]() {
+			return is_closing_ || loaded_.empty() || memory_budget_ == 0 ||
+			    buffered_bytes_ + bytes <= memory_budget_;
+		});
+		if (is_closing_)
+			break;
+		buffered_bytes_ += bytes;
+		peak_buffered_bytes_ = std::max(peak_buffered_bytes_,
+		    buffered_bytes_);
+		loaded_.push_back(composite);
+		loaded_condition_.notify_one();
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	is_loader_done_ = true;
+	loaded_condition_.notify_one();
+}
+
+bool CompositeStream::Next(Composite *pcomposite) {
+	assert(pcomposite);
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	std::unique_lock<std::mutex> lock(mutex_);
+	loaded_condition_.wait(lock, [this]() {
+		return !loaded_.empty() || is_loader_done_;
+	});
+	wait_seconds_ += SecondsSince(start);
+	if (loaded_.empty())
+		return false;
+
+	*pcomposite = loaded_.front();
+	loaded_.pop_front();
+	buffered_bytes_ -= PictureBytes(pcomposite->picture);
+	taken_condition_.notify_one();
+	return true;
+}
+
+void CompositeStream::Close() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_closing_ = true;
+		taken_condition_.notify_one();
+	}
+	if (loader_.joinable())
+		loader_.join();
+	loaded_.clear();
+	buffered_bytes_ = 0;
+	pack_.Close();
+}
@@ -0,0 +1,77 @@
+// Streaming reader of the test composites. The list is parsed at once, the
+// pictures are loaded by the background thread at most prefetch_count ahead
+// of the consumer, so decoding of the next composites overlaps with matching
+// of the current one. A decoded picture is queued only when the queued ones
+// and it fit into the memory budget, a picture larger than the whole budget
+// is queued alone. So memory does not grow with the count of composites: it
+// is at most the budget plus the one picture waiting to be queued.
+
+#ifndef COMPOSITE_STREAM_H
+#define COMPOSITE_STREAM_H
+
+#include <opencv2/core/core.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_pack.h"
+
+class CompositeStream {
+public:
+	struct Composite {
+		std::string file_name;
+		cv::Mat picture;
+		std::vector<std::string> sign_names; // expected signs
+	};
+
+	CompositeStream();
+	~CompositeStream();
+
+	// Reads the test list or the pack made from it and starts loading
+	bool Open(const std::string& file_name, size_t prefetch_count,
+	    size_t memory_budget);
+	// Takes the next composite, waits until it's loaded. Returns false at
+	// the end of the list or if the picture cannot be loaded. Pictures read
+	// from the pack are valid while the stream is opened.
+	bool Next(Composite *pcomposite);
+	void Close();
+
+	bool IsFailed() const { return is_failed_; }
+	size_t CompositesCount() const { return composites_.size(); }
+	// Time the consumer waited for the pictures and the loader spent on
+	// loading them
+	double WaitSeconds() const { return wait_seconds_; }
+	double LoadSeconds() const { return load_seconds_; }
+	// Max total size of the loaded pictures waiting for the consumer
+	size_t PeakBufferedBytes() const { return peak_buffered_bytes_; }
+
+private:
+	CompositeStream(const CompositeStream&);
+	CompositeStream& operator=(const CompositeStream&);
+
+	void LoaderLoop();
+
+	ImagePack pack_;
+	// composites of the list without pictures
+	std::vector<Composite> composites_;
+	size_t prefetch_count_;
+	size_t memory_budget_;
+
+	std::thread loader_;
+	std::mutex mutex_;
+	std::condition_variable loaded_condition_;
+	std::condition_variable taken_condition_;
+	std::deque<Composite> loaded_;
+	size_t buffered_bytes_;
+	size_t peak_buffered_bytes_;
+	bool is_loader_done_;
+	bool is_closing_;
+	bool is_failed_;
+	double wait_seconds_;
+	double load_seconds_;
+};
+
+#endif // COMPOSITE_STREAM_H
@@ -1,7 +1,6 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/objdetect/objdetect.hpp>
-#include <opencv2/contrib/contrib.hpp>
 #include <iostream>
 #include <fstream>
 #include <stdio.h>
@@ -9,65 +8,56 @@
 #include <vector>
 #include <set>
 #include <assert.h>
+#include <sstream>
+#include <chrono>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "composite_stream.h"
+#include "image_pack.h"
+#include "memory_usage.h"
+#include "orientation_matcher.h"
+#include "sign_classifier.h"
+#include "sign_service.h"
 
 using std::ifstream;
 using std::ofstream;
+using std::istringstream;
 using namespace cv;
 
-void SignPicturePreprocessing(Mat *psign_picture) {
-	cvtColor(*psign_picture, *psign_picture, CV_BGR2GRAY);
-	GaussianBlur(*psign_picture, *psign_picture, Size(5, 5), 0);
-	Canny(*psign_picture, *psign_picture, 60, 100);
-}
-
-
-void ShowPicture(Mat img, float score = 0) {
-	static int i = 0;
+// Sizes of the synthetic template libraries in the matching benchmark and
+// count of signs matched by the (slow) chamfer engine for every size
+const size_t BENCHMARK_LIBRARY_SIZES[] = {100, 250, 500, 1000};
+const size_t BENCHMARK_CHAMFER_SIGNS = 2;
+// Test composites are loaded at most PREFETCH_COUNT ahead of processing and
+// the loaded ones take at most MEMORY_BUDGET_MB
+const size_t PREFETCH_COUNT = 4;
+const size_t MEMORY_BUDGET_MB = 256;
+// Synthetic composites of the streaming benchmark: white canvas with the
+// grid of the known signs
+const int SYNTHETIC_COMPOSITE_WIDTH = 2048;
+const int SYNTHETIC_COMPOSITE_HEIGHT = 1536;
+const int SYNTHETIC_CELL_SIZE = 256;
+const int SYNTHETIC_SIGN_SIZE = 160;
+
+// Shows the sign in the window named by its number and matching score (the
+// chamfer cost or the orientation similarity, see ClassifySign)
+void ShowPicture(Mat img, size_t index, float score) {
 	char win_name[100] = {0};
-	sprintf(win_name, "%d %f", i++, score);
+	sprintf(win_name, "%zu %f", index, score);
 
 	namedWindow(win_name, 0);
 	imshow(win_name, img);
 }
 
 bool ProcessSign(Mat unknown_sign, const vector<Mat> &known_signs,
-    const vector<string> &sign_names, vector<string> *presults) {
+    const vector<string> &sign_names,
+    const OrientationMatcher *porientation_matcher, vector<string> *presults) {
 	assert(presults);
-	Mat unknown_sign_tmp = unknown_sign;
-
-	const int MAX_MATCHES = 10, PAD_X = 1, PAD_Y = 1, SCALES = 10;
-	const float TEMPL_SCALE = 1.0, MIN_MATCH_DISTANCE = 0.1, MIN_SCALE = 0.9,
-		    MAX_SCALE = 1.3, ORIENTATION_WEIGHT = 0.9, TRUNCATE = 1000;
-
-	SignPicturePreprocessing(&unknown_sign_tmp);
-//	ShowPicture(unknown_sign_tmp);
-
 	vector<Point> best_points;
-	float best_score = 1 << 30; // some very big number
-	size_t best_idx = 0;	
-
-	for (size_t i = 0; i < known_signs.size(); ++i) {
-		Mat scaled_candidate;
-		vector<vector<Point>> results;
-		vector<float> costs;
-		// recise sign to the size of candidate and extract edges
-		resize(known_signs[i], scaled_candidate,
-		    unknown_sign_tmp.size());
-		SignPicturePreprocessing(&scaled_candidate);
-
-		int found = chamerMatching(unknown_sign_tmp, scaled_candidate,
-		    results, costs, TEMPL_SCALE, MAX_MATCHES, 
-		    MIN_MATCH_DISTANCE, PAD_X, PAD_Y, SCALES, MIN_SCALE, 
-		    MAX_SCALE, ORIENTATION_WEIGHT, TRUNCATE);
-		if (found == -1)
-			continue;
-		if (costs[found] >= best_score) 
-			continue;
-		
-		best_score = costs[found];		
-		best_points = results[found];
-		best_idx = i;
-	}
+	float best_score = 0;
+	size_t best_idx = ClassifySign(unknown_sign, known_signs,
+	    porientation_matcher, &best_score, &best_points);
 
 	presults->push_back(sign_names[best_idx]);
 
@@ -75,65 +65,40 @@ bool ProcessSign(Mat unknown_sign, const vector<Mat> &known_signs,
 	for (Point &pt : best_points) 
 		if (pt.inside(Rect(0, 0, tmp_img.cols, tmp_img.rows)))
 			tmp_img.at<Vec3b>(pt) = Vec3b(0, 255, 0);
-	ShowPicture(tmp_img, best_score);
+	// the sign number among the results names its window
+	ShowPicture(tmp_img, presults->size() - 1, best_score);
 
 	return true;
 }
 
 
 bool ProcessSignComposite(Mat &sign_composite, const vector<Mat> &known_signs,
-    const vector<string> &sign_names, vector<string> *presults) {
+    const vector<string> &sign_names,
+    const OrientationMatcher *porientation_matcher, vector<string> *presults) {
 	assert(presults);
-	Mat tmp_sign_composite;
-	cvtColor(sign_composite, tmp_sign_composite, CV_BGR2GRAY);
-
-//	namedWindow(window_name, CV_WINDOW_AUTOSIZE );
-
-	threshold(tmp_sign_composite, tmp_sign_composite, 235,
-	    255, THRESH_TOZERO_INV);
-
-	vector<vector<Point> > contours;
-	vector<Vec4i> hierarchy;
-	findContours(tmp_sign_composite, contours, hierarchy, CV_RETR_EXTERNAL, 
-	    CV_CHAIN_APPROX_SIMPLE, Point(0, 0));
-	vector<vector<Point>> contours_poly(contours.size());
-	vector<Rect> boundRect(contours.size());
-
-	int signs_count = 0;
-	for (int i = 0; i < contours.size(); i++) {
-		approxPolyDP(Mat(contours[i]), contours_poly[i], 3, true);
-		Rect tmp_rect = boundingRect(Mat(contours_poly[i]));
-		if (tmp_rect.area() > 1800) 
-			boundRect[signs_count++] = tmp_rect;
-	}
-
-	boundRect.resize(signs_count);
-	for (Rect &rect : boundRect) 
-		if (!ProcessSign(sign_composite(rect), known_signs, sign_names, presults))
+	vector<Rect> sign_rects;
+	FindSignRectangles(sign_composite, &sign_rects);
+	for (Rect &rect : sign_rects) 
+		if (!ProcessSign(sign_composite(rect), known_signs, sign_names,
+		    porientation_matcher, presults))
 		    return false;
-
-//	Mat tmp = src.clone();
-//	for( int i = 0; i< contours.size(); i++ )
-//	       drawContours( tmp, contours_poly, i, Scalar(0, 255, 0), 1, 8, vector<Vec4i>(), 0, Point() );
-//	for( int i = 0; i< signs_count; i++ )
-//	       rectangle( tmp, boundRect[i].tl(), boundRect[i].br(), Scalar(0, 0, 255), 2, 8, 0 );
-
-//	imshow(window_name, tmp);
-	
 	return true;
-
 }
 
-bool ReadTestFile(const string &file_name, vector<Mat> *ppictures, 
-    vector<string> *psign_names) {
+// Both readers accept the list file or the pack made from it. Pictures read
+// from the pack are valid while the pack is opened.
+bool ReadTestFile(const string &file_name, ImagePack *ppack,
+    vector<Mat> *ppictures, vector<string> *psign_names) {
+	assert(ppack);
 	assert(ppictures);
 	assert(psign_names);
 	ppictures->clear();
 	psign_names->clear();
 
-	ifstream fin(file_name.c_str()); 
-	if (!fin.is_open())
+	string list;
+	if (!ppack->ReadList(file_name, &list))
 		return false;
+	istringstream fin(list);
 
 	while (!fin.eof()) {
 		string tmp_file_name;
@@ -141,7 +106,7 @@ bool ReadTestFile(const string &file_name, vector<Mat> *ppictures,
 		if (tmp_file_name.length() == 0)
 			return true;
 
-		Mat img = imread(tmp_file_name.c_str(), CV_LOAD_IMAGE_COLOR);
+		Mat img = ppack->LoadImage(tmp_file_name);
 		if (!img.data)
 			return false;
 
@@ -158,23 +123,25 @@ bool ReadTestFile(const string &file_name, vector<Mat> *ppictures,
 	return true;
 }
 
-bool ReadLearningPictures(const string &file_name, vector<Mat> *psign_pictures,
-    vector<string> *psign_names) {
+bool ReadLearningPictures(const string &file_name, ImagePack *ppack,
+    vector<Mat> *psign_pictures, vector<string> *psign_names) {
+	assert(ppack);
 	assert(psign_names);
 	assert(psign_pictures);
 	psign_names->clear();
 	psign_pictures->clear();
 
-	ifstream fin(file_name.c_str()); 
-	if (!fin.is_open())
+	string list;
+	if (!ppack->ReadList(file_name, &list))
 		return false;
+	istringstream fin(list);
 
 	while (!fin.eof()) {
 		string tmp_file_name;
 		fin >> tmp_file_name;
 		if (tmp_file_name.length() == 0)
 			return true;
-		Mat img = imread(tmp_file_name.c_str(), CV_LOAD_IMAGE_COLOR);
+		Mat img = ppack->LoadImage(tmp_file_name);
 		img = img(Rect(5, 0, img.size().width - 10, img.size().height));
 		if (!img.data)
 			return false;
@@ -216,6 +183,188 @@ void ComputePerformanceMetrics(const vector<string> &answers,
 	    "recall = %f\n", accuracy, precision, recall);
 }
 
+// Library of count templates made of the known signs rotated and scaled by
+// random small amounts
+void MakeSyntheticLibrary(const vector<Mat> &known_signs, size_t count,
+    vector<Mat> *plibrary) {
+	assert(plibrary);
+	plibrary->clear();
+	RNG rng(count);
+	for (size_t i = 0; i < count; i++) {
+		const Mat &sign = known_signs[i % known_signs.size()];
+		Mat transform = getRotationMatrix2D(
+		    Point2f(sign.cols / 2.0f, sign.rows / 2.0f),
+		    rng.uniform(-20.0, 20.0), rng.uniform(0.9, 1.1));
+		Mat tmp_sign;
+		warpAffine(sign, tmp_sign, transform, sign.size(), INTER_LINEAR,
+		    BORDER_REPLICATE);
+		plibrary->push_back(tmp_sign);
+	}
+}
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(
+	    std::chrono::steady_clock::now() - start).count();
+}
+
+// Compares matching time of both engines on the signs of the composites for
+// the synthetic template libraries of different sizes
+void BenchmarkLibraries(const vector<Mat> &known_signs,
+    const vector<Mat> &sign_composites) {
+	vector<Mat> signs;
+	for (const Mat &composite : sign_composites) {
+		vector<Rect> sign_rects;
+		FindSignRectangles(composite, &sign_rects);
+		for (const Rect &rect : sign_rects)
+			signs.push_back(composite(rect));
+	}
+	if (signs.empty() || known_signs.empty())
+		return;
+
+	for (size_t library_size : BENCHMARK_LIBRARY_SIZES) {
+		vector<Mat> library;
+		MakeSyntheticLibrary(known_signs, library_size, &library);
+
+		std::chrono::steady_clock::time_point start =
+		    std::chrono::steady_clock::now();
+		OrientationMatcher matcher;
+		for (size_t i = 0; i < library.size(); i++)
+			matcher.AddTemplate(library[i], i);
+		double build_ms = MillisecondsSince(start);
+
+		float score = 0;
+		vector<Point> points;
+		start = std::chrono::steady_clock::now();
+		for (const Mat &sign : signs)
+			ClassifySign(sign, library, &matcher, &score, &points);
+		double orientations_ms = MillisecondsSince(start) / signs.size();
+
+		size_t chamfer_signs = std::min(signs.size(),
+		    BENCHMARK_CHAMFER_SIGNS);
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < chamfer_signs; i++)
+			ClassifySign(signs[i], library, NULL, &score, &points);
+		double chamfer_ms = MillisecondsSince(start) / chamfer_signs;
+
+		printf("%zu templates: orientation library build %.1f ms, "
+		    "orientations %.2f ms/sign, chamfer %.2f ms/sign\n",
+		    library_size, build_ms, orientations_ms, chamfer_ms);
+	}
+}
+
+// Prints how much of the loading was hidden behind processing and the memory
+// used by the stream
+void PrintStreamStats(const CompositeStream &stream, double seconds) {
+	size_t rss_kb = 0, peak_rss_kb = 0;
+	ReadMemoryUsage(&rss_kb, &peak_rss_kb);
+	double overlap = stream.LoadSeconds() > 0 ?
+	    std::max(0.0, 1 - stream.WaitSeconds() / stream.LoadSeconds()) : 1;
+	fprintf(stderr, "%zu composites in %.2f s (%.1f/s): loading %.2f s, "
+	    "waiting %.2f s, %.1f%% of loading overlapped, peak buffered "
+	    "%.1f MB, peak rss %zu kB\n", stream.CompositesCount(), seconds,
+	    stream.CompositesCount() / std::max(seconds, 1e-9),
+	    stream.LoadSeconds(), stream.WaitSeconds(), 100 * overlap,
+	    stream.PeakBufferedBytes() / 1048576.0, peak_rss_kb);
+}
+
+// Writes count synthetic composites of the known signs and their list to the
+// directory, adds names of the written files to *pfiles
+bool MakeSyntheticComposites(const vector<Mat> &known_signs,
+    const vector<string> &sign_names, size_t count, const string &directory,
+    vector<string> *pfiles) {
+	assert(pfiles);
+	RNG rng(count);
+	std::ostringstream list;
+	for (size_t i = 0; i < count; i++) {
+		Mat composite(SYNTHETIC_COMPOSITE_HEIGHT, SYNTHETIC_COMPOSITE_WIDTH,
+		    CV_8UC3, Scalar::all(255));
+		vector<string> names;
+		for (int y = 0; y + SYNTHETIC_CELL_SIZE <= composite.rows;
+		    y += SYNTHETIC_CELL_SIZE)
+			for (int x = 0; x + SYNTHETIC_CELL_SIZE <= composite.cols;
+			    x += SYNTHETIC_CELL_SIZE) {
+				size_t idx = rng.uniform(0, (int) known_signs.size());
+				int offset = (SYNTHETIC_CELL_SIZE - SYNTHETIC_SIGN_SIZE) / 2;
+				Mat cell = composite(Rect(x + offset, y + offset,
+				    SYNTHETIC_SIGN_SIZE, SYNTHETIC_SIGN_SIZE));
+				resize(known_signs[idx], cell, cell.size());
+				names.push_back(sign_names[idx]);
+			}
+
+		std::ostringstream file_name;
+		file_name << directory << "/composite" << i << ".png";
+		if (!imwrite(file_name.str(), composite))
+			return false;
+		pfiles->push_back(file_name.str());
+		list << file_name.str() << " " << names.size();
+		for (const string &name : names)
+			list << " " << name;
+		list << "\n";
+	}
+
+	string list_file = directory + "/list.txt";
+	ofstream fout(list_file.c_str());
+	fout << list.str();
+	pfiles->push_back(list_file);
+	return fout.good();
+}
+
+// Streams count large synthetic composites through the orientation engine
+// and reports the loading overlap and the memory usage
+bool BenchmarkStreaming(const vector<Mat> &known_signs,
+    const vector<string> &sign_names, size_t count, size_t prefetch_count,
+    size_t memory_budget) {
+	if (known_signs.empty())
+		return false;
+	char directory[] = "/tmp/signs_stream_XXXXXX";
+	if (!mkdtemp(directory))
+		return false;
+	vector<string> files;
+	bool is_written = MakeSyntheticComposites(known_signs, sign_names, count,
+	    directory, &files);
+
+	OrientationMatcher matcher;
+	for (size_t i = 0; i < known_signs.size(); i++)
+		matcher.AddTemplate(known_signs[i], i);
+
+	CompositeStream stream;
+	vector<string> correct_names, predicted_names;
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	bool is_streamed = is_written && stream.Open(string(directory) +
+	    "/list.txt", prefetch_count, memory_budget);
+	CompositeStream::Composite composite;
+	while (is_streamed && stream.Next(&composite)) {
+		correct_names.insert(correct_names.end(),
+		    composite.sign_names.begin(), composite.sign_names.end());
+		vector<Rect> sign_rects;
+		FindSignRectangles(composite.picture, &sign_rects);
+		for (const Rect &rect : sign_rects) {
+			float score = 0;
+			vector<Point> points;
+			predicted_names.push_back(sign_names[ClassifySign(
+			    composite.picture(rect), known_signs, &matcher, &score,
+			    &points)]);
+		}
+	}
+	double seconds = std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start).count();
+	if (is_streamed && !stream.IsFailed()) {
+		PrintStreamStats(stream, seconds);
+		// rectangles are found in the grid order, so names are comparable
+		// unless some sign is missed
+		if (predicted_names.size() == correct_names.size())
+			ComputePerformanceMetrics(correct_names, predicted_names,
+			    sign_names);
+	}
+	stream.Close();
+
+	for (const string &file : files)
+		unlink(file.c_str());
+	rmdir(directory);
+	return is_streamed && !stream.IsFailed();
+}
+
 void WaitUntilExit() {
 	while (true) {
 		int c = waitKey( 20 );
@@ -225,19 +374,104 @@ void WaitUntilExit() {
 }
 
 int main(int argc, char** argv) {
+	// list files (or packs made from them) may be given instead of defaults
+	string learning_file = "learning_signs.txt";
+	string test_file = "test_sample.txt";
+	bool is_orientations = false, is_benchmark = false;
+	size_t prefetch_count = PREFETCH_COUNT;
+	size_t memory_budget = MEMORY_BUDGET_MB << 20;
+	size_t stream_benchmark_count = 0;
+	string socket_path;
+	vector<string> list_files;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--serve" && i + 1 < argc)
+			socket_path = argv[++i];
+		else if (arg == "--orientations")
+			is_orientations = true;
+		else if (arg == "--benchmark-library")
+			is_benchmark = true;
+		else if (arg == "--prefetch" && i + 1 < argc)
+			prefetch_count = std::max(atoi(argv[++i]), 1);
+		else if (arg == "--memory-budget" && i + 1 < argc)
+			memory_budget = (size_t) atoi(argv[++i]) << 20;
+		else if (arg == "--benchmark-stream" && i + 1 < argc)
+			stream_benchmark_count = atoi(argv[++i]);
+		else
+			list_files.push_back(arg);
+	}
+	if (list_files.size() > 0)
+		learning_file = list_files[0];
+	if (list_files.size() > 1)
+		test_file = list_files[1];
+
+	ImagePack learning_pack;
 	vector<Mat> known_signs;
 	vector<string> sign_names;
-	ReadLearningPictures("learning_signs.txt", &known_signs, 
+	ReadLearningPictures(learning_file, &learning_pack, &known_signs, 
 	    &sign_names);
 
-	vector<Mat> sign_composites;
+	// resident service mode, see sign_service.h for the protocol
+	if (socket_path.length() > 0) {
+		SignService service;
+		for (size_t i = 0; i < known_signs.size(); i++)
+			service.AddTemplate(sign_names[i], known_signs[i]);
+		if (!service.Run(socket_path)) {
+			fprintf(stderr, "Cannot serve on %s\n", socket_path.c_str());
+			return -1;
+		}
+		return 0;
+	}
+
+	if (stream_benchmark_count > 0) {
+		if (!BenchmarkStreaming(known_signs, sign_names,
+		    stream_benchmark_count, prefetch_count, memory_budget)) {
+			fprintf(stderr, "Cannot stream synthetic composites\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	if (is_benchmark) {
+		// all the signs are matched by every library
+		ImagePack test_pack;
+		vector<Mat> sign_composites;
+		vector<string> correct_names;
+		ReadTestFile(test_file, &test_pack, &sign_composites,
+		    &correct_names);
+		BenchmarkLibraries(known_signs, sign_composites);
+		return 0;
+	}
+
+	OrientationMatcher orientation_matcher;
+	if (is_orientations)
+		for (size_t i = 0; i < known_signs.size(); i++)
+			orientation_matcher.AddTemplate(known_signs[i], i);
+
+	// composites are loaded in background while the current one is matched
+	CompositeStream stream;
 	vector<string> correct_names;
 	vector<string> predicted_names;
-	ReadTestFile("test_sample.txt", &sign_composites, &correct_names);
-
-	for (Mat& sign_composite : sign_composites) 
-		ProcessSignComposite(sign_composite, known_signs, sign_names,
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	if (!stream.Open(test_file, prefetch_count, memory_budget)) {
+		fprintf(stderr, "Cannot read test file %s\n", test_file.c_str());
+		return -1;
+	}
+	CompositeStream::Composite composite;
+	while (stream.Next(&composite)) {
+		correct_names.insert(correct_names.end(),
+		    composite.sign_names.begin(), composite.sign_names.end());
+		ProcessSignComposite(composite.picture, known_signs, sign_names,
+		    is_orientations ? &orientation_matcher : NULL,
 		    &predicted_names); 
+	}
+	if (stream.IsFailed()) {
+		fprintf(stderr, "Cannot load composite from %s\n",
+		    test_file.c_str());
+		return -1;
+	}
+	PrintStreamStats(stream, MillisecondsSince(start) / 1000);
 	
 	ComputePerformanceMetrics(correct_names, predicted_names, sign_names);
 
@@ -0,0 +1,298 @@
+#include "orientation_matcher.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <assert.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace cv;
+using std::vector;
+
+// Count of gradient direction bins in [0, 180) degrees
+const int ORIENTATIONS = 8;
+// Orientations are spread over SPREAD x SPREAD cell, anchors of templates are
+// on the grid with the same step
+const int SPREAD = 4;
+// Gradients weaker than MIN_MAGNITUDE have no orientation
+const float MIN_MAGNITUDE = 40;
+// Signs are resized to CANONICAL_SIZE square and padded by PADDING pixels
+// to leave room for the template shifts
+const int CANONICAL_SIZE = 64;
+const int PADDING = 8;
+// Templates are built at these scales of the canonical size
+const float TEMPLATE_SCALES[] = {0.85, 0.95, 1.05, 1.15};
+// Similarity of orientations is 4 for the same bin and 0 for orthogonal
+// ones, so the 8-bit score sum of MAX_FEATURES features never saturates
+const int MAX_SIMILARITY = 4;
+const int MAX_FEATURES = 63;
+// Features are taken from the strongest gradients at least
+// FEATURE_DISTANCE pixels from each other
+const int FEATURE_DISTANCE = 3;
+
+// Converts color picture to the map of single bit orientation masks (0 for
+// weak gradients) and gradient magnitudes
+static void QuantizeOrientations(const Mat& picture, Mat *pquantized,
+    Mat *pmagnitude) {
+	assert(pquantized);
+	assert(pmagnitude);
+	Mat gray, dx, dy, angle;
+	if (picture.channels() == 1)
+		gray = picture.clone();
+	else
+		cvtColor(picture, gray, CV_BGR2GRAY);
+	GaussianBlur(gray, gray, Size(5, 5), 0);
+	Sobel(gray, dx, CV_32F, 1, 0);
+	Sobel(gray, dy, CV_32F, 0, 1);
+	cartToPolar(dx, dy, *pmagnitude, angle, true);
+
+	pquantized->create(gray.size(), CV_8U);
+	for (int y = 0; y < gray.rows; y++) {
+		const float *pmag = pmagnitude->ptr<float>(y);
+		const float *pangle = angle.ptr<float>(y);
+		uchar *pq = pquantized->ptr<uchar>(y);
+		for (int x = 0; x < gray.cols; x++) {
+			// gradient polarity is ignored
+			float direction = pangle[x] >= 180 ? pangle[x] - 180 :
+			    pangle[x];
+			int bin = (int) (direction * ORIENTATIONS / 180) %
+			    ORIENTATIONS;
+			pq[x] = pmag[x] < MIN_MAGNITUDE ? 0 : 1 << bin;
+		}
+	}
+}
+
+// ORs each orientation mask into the SPREAD x SPREAD cell before it
+static void SpreadOrientations(const Mat& quantized, Mat *pspread) {
+	assert(pspread);
+	*pspread = Mat::zeros(quantized.size(), CV_8U);
+	for (int dy = 0; dy < SPREAD; dy++)
+		for (int dx = 0; dx < SPREAD; dx++) {
+			Rect to(0, 0, quantized.cols - dx, quantized.rows - dy);
+			Mat tmp = (*pspread)(to);
+			bitwise_or(tmp, quantized(Rect(dx, dy, to.width,
+			    to.height)), tmp);
+		}
+}
+
+// Lookup tables from the spread mask to the best similarity with each
+// orientation
+static vector<Mat> BuildSimilarityTables() {
+	vector<Mat> tables;
+	for (int orientation = 0; orientation < ORIENTATIONS; orientation++) {
+		Mat table(1, 256, CV_8U);
+		for (int mask = 0; mask < 256; mask++) {
+			int best = 0;
+			for (int bin = 0; bin < ORIENTATIONS; bin++) {
+				if (!(mask & (1 << bin)))
+					continue;
+				int distance = abs(orientation - bin);
+				distance = std::min(distance,
+				    ORIENTATIONS - distance);
+				best = std::max(best, MAX_SIMILARITY - distance);
+			}
+			table.at<uchar>(0, mask) = best;
+		}
+		tables.push_back(table);
+	}
+	return tables;
+}
+
+static const vector<Mat>& SimilarityTables() {
+	static const vector<Mat> tables = BuildSimilarityTables();
+	return tables;
+}
+
+// Stores the response map as SPREAD * SPREAD rows: row (r * SPREAD + c) has
+// the map values at (r + SPREAD * i, c + SPREAD * j) in the row-major order
+static void Linearize(const Mat& response, Mat *plinear) {
+	assert(plinear);
+	int grid_width = response.cols / SPREAD;
+	int grid_height = response.rows / SPREAD;
+	plinear->create(SPREAD * SPREAD, grid_width * grid_height, CV_8U);
+	for (int r = 0; r < SPREAD; r++)
+		for (int c = 0; c < SPREAD; c++) {
+			uchar *pdst = plinear->ptr<uchar>(r * SPREAD + c);
+			for (int i = 0; i < grid_height; i++) {
+				const uchar *psrc = response.ptr<uchar>(
+				    r + SPREAD * i);
+				for (int j = 0; j < grid_width; j++)
+					*pdst++ = psrc[c + SPREAD * j];
+			}
+		}
+}
+
+// acc[i] += src[i] with saturation
+static void AddSaturate(uchar *pacc, const uchar *psrc, int size) {
+	int i = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= size; i += 16) {
+		__m128i acc = _mm_loadu_si128((const __m128i*) (pacc + i));
+		__m128i src = _mm_loadu_si128((const __m128i*) (psrc + i));
+		_mm_storeu_si128((__m128i*) (pacc + i), _mm_adds_epu8(acc, src));
+	}
+#endif
+	for (; i < size; i++)
+		pacc[i] = std::min(255, pacc[i] + psrc[i]);
+}
+
+void OrientationMatcher::AddTemplate(const Mat& templ, int class_id) {
+	for (float scale : TEMPLATE_SCALES) {
+		int size = (int) (scale * CANONICAL_SIZE);
+		Mat scaled, quantized, magnitude;
+		resize(templ, scaled, Size(size, size));
+		QuantizeOrientations(scaled, &quantized, &magnitude);
+
+		// candidates sorted by gradient magnitude, image border is
+		// skipped as Sobel is not reliable there
+		vector<std::pair<float, Point> > candidates;
+		for (int y = 1; y < size - 1; y++)
+			for (int x = 1; x < size - 1; x++)
+				if (quantized.at<uchar>(y, x))
+					candidates.push_back(std::make_pair(
+					    -magnitude.at<float>(y, x),
+					    Point(x, y)));
+		std::sort(candidates.begin(), candidates.end(),
+		    [](const std::pair<float, Point>& a,
+		    const std::pair<float, Point>& b) {
+			return a.first < b.first;
+		});
+
+		Template tmp_template;
+		tmp_template.class_id = class_id;
+		tmp_template.width = size;
+		tmp_template.height = size;
+		for (size_t i = 0; i < candidates.size() &&
+		    tmp_template.features.size() < (size_t) MAX_FEATURES; i++) {
+			Point p = candidates[i].second;
+			bool is_far = true;
+			for (const Feature& f : tmp_template.features)
+				if (abs(f.x - p.x) < FEATURE_DISTANCE &&
+				    abs(f.y - p.y) < FEATURE_DISTANCE) {
+					is_far = false;
+					break;
+				}
+			if (!is_far)
+				continue;
+			Feature feature;
+			feature.x = p.x;
+			feature.y = p.y;
+			uchar mask = quantized.at<uchar>(p);
+			feature.orientation = 0;
+			while (!(mask & (1 << feature.orientation)))
+				feature.orientation++;
+			tmp_template.features.push_back(feature);
+		}
+		if (!tmp_template.features.empty())
+			templates_.push_back(tmp_template);
+	}
+}
+
+bool OrientationMatcher::RemoveTemplates(int class_id) {
+	size_t kept_count = 0;
+	for (size_t t = 0; t < templates_.size(); t++)
+		if (templates_[t].class_id != class_id)
+			templates_[kept_count++] = templates_[t];
+	bool is_removed = kept_count != templates_.size();
+	templates_.resize(kept_count);
+	return is_removed;
+}
+
+// Linear memories of the response maps of all orientations for the sign
+// resized to the canonical size and padded
+static void ComputeLinearMemories(const Mat& sign,
+    vector<Mat> *plinear_memories) {
+	assert(plinear_memories);
+	Mat canonical, quantized, magnitude, spread;
+	resize(sign, canonical, Size(CANONICAL_SIZE, CANONICAL_SIZE));
+	copyMakeBorder(canonical, canonical, PADDING, PADDING, PADDING, PADDING,
+	    BORDER_REPLICATE);
+	QuantizeOrientations(canonical, &quantized, &magnitude);
+	SpreadOrientations(quantized, &spread);
+
+	const vector<Mat>& tables = SimilarityTables();
+	plinear_memories->resize(ORIENTATIONS);
+	for (int orientation = 0; orientation < ORIENTATIONS; orientation++) {
+		Mat response;
+		LUT(spread, tables[orientation], response);
+		Linearize(response, &(*plinear_memories)[orientation]);
+	}
+}
+
+void OrientationMatcher::MatchBatch(const vector<Mat>& signs,
+    vector<MatchResult> *presults) const {
+	assert(presults);
+	presults->assign(signs.size(), MatchResult());
+
+	// response maps are computed once for all templates
+	vector<vector<Mat> > linear_memories(signs.size());
+	for (size_t s = 0; s < signs.size(); s++)
+		ComputeLinearMemories(signs[s], &linear_memories[s]);
+
+	const int GRID_SIZE = (CANONICAL_SIZE + 2 * PADDING) / SPREAD;
+	vector<uchar> scores(GRID_SIZE * GRID_SIZE);
+
+	// templates are in the outer loop, so the features of the template
+	// stay in cache while all the signs of the batch are scored
+	for (size_t t = 0; t < templates_.size(); t++) {
+		const Template &templ = templates_[t];
+		// anchors at which the template fits into the picture
+		int max_i = (GRID_SIZE * SPREAD - templ.height) / SPREAD;
+		int max_j = (GRID_SIZE * SPREAD - templ.width) / SPREAD;
+		if (max_i < 0 || max_j < 0)
+			continue;
+		// scores of all anchors (i, j) are stored in one row-major span,
+		// the anchors with j > max_j in it are not valid
+		int span = max_i * GRID_SIZE + max_j + 1;
+		float norm = 1.0f / (MAX_SIMILARITY * templ.features.size());
+
+		for (size_t s = 0; s < signs.size(); s++) {
+			std::fill(scores.begin(), scores.begin() + span, 0);
+			for (const Feature& f : templ.features) {
+				const uchar *psrc = linear_memories[s][
+				    f.orientation].ptr<uchar>(
+				    (f.y % SPREAD) * SPREAD + f.x % SPREAD) +
+				    (f.y / SPREAD) * GRID_SIZE + f.x / SPREAD;
+				AddSaturate(scores.data(), psrc, span);
+			}
+
+			MatchResult &result = (*presults)[s];
+			for (int i = 0; i <= max_i; i++)
+				for (int j = 0; j <= max_j; j++) {
+					float score = scores[i * GRID_SIZE + j] *
+					    norm;
+					// similarity, the highest one wins
+					if (result.template_index != -1 &&
+					    score <= result.score)
+						continue;
+					result.score = score;
+					result.template_index = t;
+					result.class_id = templ.class_id;
+					result.anchor = Point(j * SPREAD, i * SPREAD);
+				}
+		}
+	}
+}
+
+int OrientationMatcher::Match(const Mat& sign, float *pscore,
+    vector<Point> *ppoints) const {
+	assert(pscore);
+	assert(ppoints);
+	ppoints->clear();
+
+	vector<MatchResult> results;
+	MatchBatch(vector<Mat>(1, sign), &results);
+	const MatchResult &result = results[0];
+	*pscore = result.score;
+	if (result.template_index == -1)
+		return -1;
+
+	// features back in the sign picture coordinates
+	const Template &best = templates_[result.template_index];
+	for (const Feature& f : best.features)
+		ppoints->push_back(Point(
+		    (f.x + result.anchor.x - PADDING) * sign.cols / CANONICAL_SIZE,
+		    (f.y + result.anchor.y - PADDING) * sign.rows / CANONICAL_SIZE));
+	return result.class_id;
+}
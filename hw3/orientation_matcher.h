@@ -0,0 +1,67 @@
+// Template matching by quantized gradient orientations. Gradient directions
+// are quantized to ORIENTATIONS bins and spread over the SPREAD x SPREAD
+// neighbourhood as bitmasks. For every orientation the response map keeps its
+// best similarity to the spread ones. Response maps are stored as linear
+// memories (one per position inside the SPREAD x SPREAD cell), so a template
+// feature contributes to the scores of all anchor positions by one contiguous
+// vector addition. Response maps are computed once per sign, and every
+// template only costs its features count of vector additions.
+//
+// Scores are similarities: higher is better, 1 means every template feature
+// has the same orientation in the sign. The chamfer cost of ClassifySign is
+// a distance, lower is better, so the two are never compared with each other.
+
+#ifndef ORIENTATION_MATCHER_H
+#define ORIENTATION_MATCHER_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+class OrientationMatcher {
+public:
+	struct MatchResult {
+		MatchResult(): class_id (-1), template_index (-1), score (0) {}
+
+		int class_id;       // -1 if there are no templates
+		int template_index; // best template (one of the class scales)
+		float score;        // in [0, 1], higher is better
+		cv::Point anchor;   // template position in the padded canonical sign
+	};
+
+	// Builds template features at all scales from the sign picture
+	void AddTemplate(const cv::Mat& templ, int class_id);
+	// Removes all templates of the class, returns false if there are none
+	bool RemoveTemplates(int class_id);
+	size_t TemplatesCount() const { return templates_.size(); }
+
+	// Finds the best matching templates for the batch of sign pictures
+	// (color or gray). Every template is scored against all pictures of the
+	// batch at once.
+	void MatchBatch(const std::vector<cv::Mat>& signs,
+	    std::vector<MatchResult> *presults) const;
+
+	// Finds the best matching template of the sign picture. Returns
+	// its class id or -1 if there are no templates. Score is in [0, 1],
+	// higher is better. Points are template features in the sign picture
+	// coordinates.
+	int Match(const cv::Mat& sign, float *pscore,
+	    std::vector<cv::Point> *ppoints) const;
+
+private:
+	struct Feature {
+		int x;
+		int y;
+		int orientation;
+	};
+
+	struct Template {
+		int class_id;
+		int width;
+		int height;
+		std::vector<Feature> features;
+	};
+
+	std::vector<Template> templates_;
+};
+
+#endif // ORIENTATION_MATCHER_H
@@ -0,0 +1,92 @@
+#include "sign_classifier.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/contrib/contrib.hpp>
+#include <assert.h>
+
+using std::vector;
+using namespace cv;
+
+static void SignPicturePreprocessing(const Mat &sign_picture, Mat *pedges) {
+	assert(pedges);
+	cvtColor(sign_picture, *pedges, CV_BGR2GRAY);
+	GaussianBlur(*pedges, *pedges, Size(5, 5), 0);
+	Canny(*pedges, *pedges, 60, 100);
+}
+
+size_t ClassifySign(const Mat &unknown_sign, const vector<Mat> &known_signs,
+    const OrientationMatcher *porientation_matcher, float *pscore,
+    vector<Point> *pbest_points) {
+	assert(pscore);
+	assert(pbest_points);
+	pbest_points->clear();
+	if (porientation_matcher) {
+		int class_id = porientation_matcher->Match(unknown_sign, pscore,
+		    pbest_points);
+		return class_id == -1 ? 0 : class_id;
+	}
+
+	const int MAX_MATCHES = 10, PAD_X = 1, PAD_Y = 1, SCALES = 10;
+	const float TEMPL_SCALE = 1.0, MIN_MATCH_DISTANCE = 0.1, MIN_SCALE = 0.9,
+		    MAX_SCALE = 1.3, ORIENTATION_WEIGHT = 0.9, TRUNCATE = 1000;
+
+	Mat unknown_sign_tmp;
+	SignPicturePreprocessing(unknown_sign, &unknown_sign_tmp);
+
+	vector<Point> &best_points = *pbest_points;
+	float &best_score = *pscore;
+	best_score = 1 << 30; // some very big number
+	size_t best_idx = 0;	
+
+	for (size_t i = 0; i < known_signs.size(); ++i) {
+		Mat scaled_candidate;
+		vector<vector<Point>> results;
+		vector<float> costs;
+		// recise sign to the size of candidate and extract edges
+		resize(known_signs[i], scaled_candidate,
+		    unknown_sign_tmp.size());
+		SignPicturePreprocessing(scaled_candidate, &scaled_candidate);
+
+		int found = chamerMatching(unknown_sign_tmp, scaled_candidate,
+		    results, costs, TEMPL_SCALE, MAX_MATCHES, 
+		    MIN_MATCH_DISTANCE, PAD_X, PAD_Y, SCALES, MIN_SCALE, 
+		    MAX_SCALE, ORIENTATION_WEIGHT, TRUNCATE);
+		if (found == -1)
+			continue;
+		// chamfer cost is a distance, the lowest one wins
+		if (costs[found] >= best_score) 
+			continue;
+		
+		best_score = costs[found];		
+		best_points = results[found];
+		best_idx = i;
+	}
+	return best_idx;
+}
+
+void FindSignRectangles(const Mat &sign_composite, vector<Rect> *psign_rects) {
+	assert(psign_rects);
+	Mat tmp_sign_composite;
+	cvtColor(sign_composite, tmp_sign_composite, CV_BGR2GRAY);
+
+	threshold(tmp_sign_composite, tmp_sign_composite, 235,
+	    255, THRESH_TOZERO_INV);
+
+	vector<vector<Point> > contours;
+	vector<Vec4i> hierarchy;
+	findContours(tmp_sign_composite, contours, hierarchy, CV_RETR_EXTERNAL, 
+	    CV_CHAIN_APPROX_SIMPLE, Point(0, 0));
+	vector<vector<Point>> contours_poly(contours.size());
+	vector<Rect> boundRect(contours.size());
+
+	int signs_count = 0;
+	for (int i = 0; i < contours.size(); i++) {
+		approxPolyDP(Mat(contours[i]), contours_poly[i], 3, true);
+		Rect tmp_rect = boundingRect(Mat(contours_poly[i]));
+		if (tmp_rect.area() > 1800) 
+			boundRect[signs_count++] = tmp_rect;
+	}
+
+	boundRect.resize(signs_count);
+	psign_rects->swap(boundRect);
+}
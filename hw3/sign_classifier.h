@@ -0,0 +1,31 @@
+// Road sign classification: finds sign rectangles on the composite picture
+// and classifies every sign by the known ones, by chamfer matching of the
+// edge maps or by the orientation matcher. Both functions expect BGR
+// pictures; the unknown sign may be a ROI of the composite and known signs
+// are resized to its size on every call.
+
+#ifndef SIGN_CLASSIFIER_H
+#define SIGN_CLASSIFIER_H
+
+#include <opencv2/core/core.hpp>
+#include <stddef.h>
+#include <vector>
+
+#include "orientation_matcher.h"
+
+// Finds bounding rectangles of the signs on the BGR composite
+void FindSignRectangles(const cv::Mat &sign_composite,
+    std::vector<cv::Rect> *psign_rects);
+
+// Finds the index of the best matching known sign, by chamfer matching or by
+// the orientation engine if porientation_matcher is set (its class ids are
+// indices of known_signs). Fills the matching score and the matched template
+// points in the sign coordinates. The score of the chamfer matching is its
+// cost, lower is better; the score of the orientation engine is a similarity
+// in [0, 1], higher is better.
+size_t ClassifySign(const cv::Mat &unknown_sign,
+    const std::vector<cv::Mat> &known_signs,
+    const OrientationMatcher *porientation_matcher, float *pscore,
+    std::vector<cv::Point> *pbest_points);
+
+#endif // SIGN_CLASSIFIER_H
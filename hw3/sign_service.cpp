@@ -0,0 +1,395 @@
+#include "sign_service.h"
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/highgui/highgui_c.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
+using namespace cv;
+using std::string;
+using std::vector;
+using std::stringstream;
+using std::mutex;
+using std::unique_lock;
+using std::lock_guard;
+
+// Latency percentiles are computed over the last LATENCY_WINDOW requests
+const size_t LATENCY_WINDOW = 10000;
+// Longest request line and biggest raw picture accepted
+const size_t MAX_LINE_LENGTH = 4096;
+const size_t MAX_RAW_PICTURE_BYTES = 64 << 20;
+
+// SIGINT and SIGTERM handler writes to this pipe to wake up the accept loop
+static int stop_pipe_fds[2] = {-1, -1};
+
+static void RequestStop(int) {
+	int saved_errno = errno;
+	char byte = 0;
+	// the pipe is non-blocking, a full pipe already wakes the loop up
+	if (write(stop_pipe_fds[1], &byte, 1) == -1) {}
+	errno = saved_errno;
+}
+
+static bool SendAll(int fd, const string& data) {
+	size_t written = 0;
+	while (written < data.size()) {
+		ssize_t ret = send(fd, data.data() + written,
+		    data.size() - written, MSG_NOSIGNAL);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		written += ret;
+	}
+	return true;
+}
+
+// Reads from the socket until *pbuffer has at least size bytes
+static bool FillBuffer(int fd, string *pbuffer, size_t size) {
+	char chunk[4096];
+	while (pbuffer->size() < size) {
+		ssize_t ret = recv(fd, chunk, sizeof(chunk), 0);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		pbuffer->append(chunk, ret);
+	}
+	return true;
+}
+
+static bool ReadLine(int fd, string *pbuffer, string *pline) {
+	size_t end;
+	while ((end = pbuffer->find('\n')) == string::npos) {
+		if (pbuffer->size() > MAX_LINE_LENGTH)
+			return false;
+		if (!FillBuffer(fd, pbuffer, pbuffer->size() + 1))
+			return false;
+	}
+	*pline = pbuffer->substr(0, end);
+	pbuffer->erase(0, end + 1);
+	return true;
+}
+
+SignService::SignService():
+	next_class_id_ (0),
+	is_stopping_ (false),
+	requests_count_ (0),
+	classifications_count_ (0),
+	batches_count_ (0),
+	latencies_next_ (0) {}
+
+void SignService::AddTemplate(const string& name, const Mat& templ) {
+	if (class_ids_.find(name) == class_ids_.end()) {
+		class_ids_[name] = next_class_id_;
+		class_names_[next_class_id_] = name;
+		next_class_id_++;
+	}
+	matcher_.AddTemplate(templ, class_ids_[name]);
+}
+
+bool SignService::Run(const string& socket_path) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socket_path.length() >= sizeof(address.sun_path))
+		return false;
+	strcpy(address.sun_path, socket_path.c_str());
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd == -1)
+		return false;
+	unlink(socket_path.c_str());
+	if (bind(listen_fd, (sockaddr*) &address, sizeof(address)) == -1) {
+		close(listen_fd);
+		return false;
+	}
+	if (listen(listen_fd, SOMAXCONN) == -1 || pipe(stop_pipe_fds) == -1) {
+		close(listen_fd);
+		unlink(socket_path.c_str());
+		return false;
+	}
+	fcntl(stop_pipe_fds[1], F_SETFL, O_NONBLOCK);
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = RequestStop;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	start_time_ = std::chrono::steady_clock::now();
+	worker_ = std::thread(&SignService::WorkerLoop, this);
+	bool is_ok = AcceptClients(listen_fd);
+	// new clients cannot connect while the current ones are served
+	close(listen_fd);
+	unlink(socket_path.c_str());
+	Stop();
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	close(stop_pipe_fds[0]);
+	close(stop_pipe_fds[1]);
+	stop_pipe_fds[0] = stop_pipe_fds[1] = -1;
+	return is_ok;
+}
+
+bool SignService::AcceptClients(int listen_fd) {
+	pollfd fds[2];
+	fds[0].fd = listen_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = stop_pipe_fds[0];
+	fds[1].events = POLLIN;
+	while (true) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		if (fds[1].revents != 0)
+			return true;
+		if (fds[0].revents == 0)
+			continue;
+
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return false;
+		}
+		// client threads are detached, Stop waits for them by their fds
+		lock_guard<mutex> lock(mutex_);
+		client_fds_.insert(fd);
+		std::thread(&SignService::ServeClient, this, fd).detach();
+	}
+}
+
+void SignService::Stop() {
+	unique_lock<mutex> lock(mutex_);
+	is_stopping_ = true;
+	// blocked reads and writes of the clients fail at once
+	for (int fd : client_fds_)
+		shutdown(fd, SHUT_RDWR);
+	request_queued_.notify_all();
+	while (!client_fds_.empty())
+		client_finished_.wait(lock);
+	lock.unlock();
+	// queued requests are processed before the worker exits
+	if (worker_.joinable())
+		worker_.join();
+}
+
+void SignService::ServeClient(int fd) {
+	string buffer;
+	while (true) {
+		RequestPtr request;
+		if (!ReadRequest(fd, &buffer, &request))
+			break;
+
+		if (!request->is_done) {
+			unique_lock<mutex> lock(mutex_);
+			if (is_stopping_)
+				break;
+			queue_.push_back(request);
+			request_queued_.notify_one();
+			while (!request->is_done)
+				reply_ready_.wait(lock);
+		}
+		if (!SendAll(fd, request->reply + "\n") || request->is_last)
+			break;
+	}
+	// closed under the lock, so Stop never shuts down a reused fd
+	lock_guard<mutex> lock(mutex_);
+	close(fd);
+	client_fds_.erase(fd);
+	client_finished_.notify_all();
+}
+
+bool SignService::ReadRequest(int fd, string *pbuffer, RequestPtr *prequest) {
+	assert(pbuffer);
+	assert(prequest);
+	string line;
+	if (!ReadLine(fd, pbuffer, &line))
+		return false;
+
+	RequestPtr request(new Request());
+	request->received = std::chrono::steady_clock::now();
+	request->is_done = false;
+	request->is_last = false;
+	*prequest = request;
+
+	stringstream ss(line);
+	string command, path;
+	ss >> command;
+	if (command == "CLASSIFY" && ss >> path) {
+		request->type = Request::CLASSIFY;
+		request->picture = imread(path.c_str(), CV_LOAD_IMAGE_COLOR);
+	}
+	else if (command == "CLASSIFY_RAW") {
+		int rows = 0, cols = 0, channels = 0;
+		ss >> rows >> cols >> channels;
+		if (!ss || rows <= 0 || cols <= 0 ||
+		    (channels != 1 && channels != 3) ||
+		    (size_t) rows * cols * channels > MAX_RAW_PICTURE_BYTES) {
+			request->reply = "ERROR bad raw picture header";
+			request->is_done = true;
+			request->is_last = true;
+			return true;
+		}
+		size_t size = (size_t) rows * cols * channels;
+		if (!FillBuffer(fd, pbuffer, size))
+			return false;
+		request->type = Request::CLASSIFY;
+		request->picture = Mat(rows, cols, channels == 1 ? CV_8UC1 :
+		    CV_8UC3);
+		memcpy(request->picture.data, pbuffer->data(), size);
+		pbuffer->erase(0, size);
+	}
+	else if (command == "ADD" && ss >> request->name >> path) {
+		request->type = Request::ADD;
+		request->picture = imread(path.c_str(), CV_LOAD_IMAGE_COLOR);
+	}
+	else if (command == "REMOVE" && ss >> request->name)
+		request->type = Request::REMOVE;
+	else if (command == "STATS")
+		request->type = Request::STATS;
+	else {
+		request->reply = "ERROR unknown request";
+		request->is_done = true;
+		return true;
+	}
+
+	if ((request->type == Request::CLASSIFY ||
+	    request->type == Request::ADD) && !request->picture.data) {
+		request->reply = "ERROR cannot read picture";
+		request->is_done = true;
+	}
+	return true;
+}
+
+void SignService::WorkerLoop() {
+	while (true) {
+		vector<RequestPtr> batch;
+		{
+			unique_lock<mutex> lock(mutex_);
+			while (queue_.empty() && !is_stopping_)
+				request_queued_.wait(lock);
+			if (queue_.empty())
+				return;
+			batch.assign(queue_.begin(), queue_.end());
+			queue_.clear();
+		}
+
+		ProcessBatch(batch);
+
+		lock_guard<mutex> lock(mutex_);
+		for (RequestPtr& request : batch)
+			request->is_done = true;
+		reply_ready_.notify_all();
+	}
+}
+
+void SignService::ProcessBatch(const vector<RequestPtr>& batch) {
+	batches_count_++;
+	// requests are processed in order, consecutive classifications are
+	// matched together
+	for (size_t begin = 0; begin < batch.size();) {
+		size_t end = begin;
+		while (end < batch.size() &&
+		    batch[end]->type == Request::CLASSIFY)
+			end++;
+
+		if (end > begin) {
+			vector<Mat> pictures;
+			for (size_t i = begin; i < end; i++)
+				pictures.push_back(batch[i]->picture);
+			vector<OrientationMatcher::MatchResult> results;
+			matcher_.MatchBatch(pictures, &results);
+			for (size_t i = begin; i < end; i++) {
+				const OrientationMatcher::MatchResult &result =
+				    results[i - begin];
+				// similarity score, clients threshold it from below
+				stringstream ss;
+				if (result.class_id == -1)
+					ss << "ERROR no templates";
+				else
+					ss << "OK " <<
+					    class_names_[result.class_id] <<
+					    " " << result.score;
+				batch[i]->reply = ss.str();
+			}
+			classifications_count_ += end - begin;
+			begin = end;
+			continue;
+		}
+
+		Request &request = *batch[begin++];
+		if (request.type == Request::ADD) {
+			AddTemplate(request.name, request.picture);
+			request.reply = "OK";
+		}
+		else if (request.type == Request::REMOVE) {
+			std::map<string, int>::iterator i =
+			    class_ids_.find(request.name);
+			if (i == class_ids_.end())
+				request.reply = "ERROR unknown sign";
+			else {
+				matcher_.RemoveTemplates(i->second);
+				class_names_.erase(i->second);
+				class_ids_.erase(i);
+				request.reply = "OK";
+			}
+		}
+		else
+			request.reply = StatsReply();
+	}
+
+	std::chrono::steady_clock::time_point now =
+	    std::chrono::steady_clock::now();
+	for (const RequestPtr& request : batch) {
+		double latency_ms = std::chrono::duration<double, std::milli>(
+		    now - request->received).count();
+		if (latencies_ms_.size() < LATENCY_WINDOW)
+			latencies_ms_.push_back(latency_ms);
+		else
+			latencies_ms_[latencies_next_] = latency_ms;
+		latencies_next_ = (latencies_next_ + 1) % LATENCY_WINDOW;
+	}
+	requests_count_ += batch.size();
+}
+
+string SignService::StatsReply() {
+	double uptime = std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start_time_).count();
+	vector<double> latencies = latencies_ms_;
+	std::sort(latencies.begin(), latencies.end());
+	double percentiles[3] = {0, 0, 0};
+	const double LEVELS[3] = {0.5, 0.9, 0.99};
+	for (int i = 0; i < 3 && !latencies.empty(); i++)
+		percentiles[i] = latencies[(size_t) (LEVELS[i] *
+		    (latencies.size() - 1))];
+
+	stringstream ss;
+	ss << "OK requests=" << requests_count_ <<
+	    " classifications=" << classifications_count_ <<
+	    " batches=" << batches_count_ <<
+	    " signs=" << class_ids_.size() <<
+	    " templates=" << matcher_.TemplatesCount() <<
+	    " uptime_s=" << uptime <<
+	    " throughput_per_s=" << (uptime > 0 ? requests_count_ / uptime : 0) <<
+	    " p50_ms=" << percentiles[0] <<
+	    " p90_ms=" << percentiles[1] <<
+	    " p99_ms=" << percentiles[2];
+	return ss.str();
+}
@@ -0,0 +1,98 @@
+// Resident sign recognition service. The preprocessed template library stays
+// in memory, clients send requests over the local (Unix domain) stream socket,
+// one request per line:
+//   CLASSIFY <picture path>
+//   CLASSIFY_RAW <rows> <cols> <channels>   followed by rows*cols*channels
+//                                           bytes of 8-bit gray or BGR pixels
+//   ADD <sign name> <template picture path>
+//   REMOVE <sign name>
+//   STATS
+// Every reply is one line starting with OK or ERROR. Classification reply is
+// "OK <sign name> <score>", the score is the orientation matcher similarity
+// in [0, 1], higher is better (unlike the chamfer cost of ClassifySign).
+// After the error reply to a malformed CLASSIFY_RAW header the connection is
+// closed, since its payload cannot be told from the next request. Requests of all clients go to one
+// queue; the worker thread takes all queued requests as a batch and
+// classifies them together.
+
+#ifndef SIGN_SERVICE_H
+#define SIGN_SERVICE_H
+
+#include <opencv2/core/core.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "orientation_matcher.h"
+
+class SignService {
+public:
+	SignService();
+
+	// Adds the sign template before the service is started
+	void AddTemplate(const std::string& name, const cv::Mat& templ);
+	// Listens on the socket and serves clients until SIGINT or SIGTERM.
+	// Returns after all client threads and the worker have finished and the
+	// socket is removed, false on error.
+	bool Run(const std::string& socket_path);
+
+private:
+	struct Request {
+		enum Type {CLASSIFY, ADD, REMOVE, STATS};
+
+		Type type;
+		std::string name;
+		cv::Mat picture;
+		std::chrono::steady_clock::time_point received;
+		std::string reply;
+		bool is_done;
+		bool is_last; // the connection is closed after the reply
+	};
+	typedef std::shared_ptr<Request> RequestPtr;
+
+	// Accepts the clients until the stop is requested by a signal, returns
+	// false on error
+	bool AcceptClients(int listen_fd);
+	void ServeClient(int fd);
+	// Parses the request, reads its payload and loads the picture in the
+	// client thread. Returns false if the connection is broken.
+	bool ReadRequest(int fd, std::string *pbuffer, RequestPtr *prequest);
+	void WorkerLoop();
+	// Disconnects the clients, waits for their threads and the worker
+	void Stop();
+	void ProcessBatch(const std::vector<RequestPtr>& batch);
+	std::string StatsReply();
+
+	// owned by the worker thread only
+	OrientationMatcher matcher_;
+	std::map<std::string, int> class_ids_;
+	std::map<int, std::string> class_names_;
+	int next_class_id_;
+
+	// requests queue and the client connections
+	std::mutex mutex_;
+	std::condition_variable request_queued_;
+	std::condition_variable reply_ready_;
+	std::condition_variable client_finished_;
+	std::deque<RequestPtr> queue_;
+	std::set<int> client_fds_; // connections with running client threads
+	bool is_stopping_;
+	std::thread worker_;
+
+	// counters, owned by the worker thread
+	std::chrono::steady_clock::time_point start_time_;
+	unsigned long long requests_count_;
+	unsigned long long classifications_count_;
+	unsigned long long batches_count_;
+	std::vector<double> latencies_ms_; // ring of the last latencies
+	size_t latencies_next_;
+};
+
+#endif // SIGN_SERVICE_H
@@ -0,0 +1,157 @@
+#include "abandonment_detector.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+
+using std::vector;
+using namespace cv;
+
+// To remove noise from the foreground we use erosion with the EROSION_SIZE radius
+const unsigned int EROSION_SIZE = 2; 
+// To connect somehow disconnected parts of one object we use dilation with the
+// DILATION_DIZE radius
+const unsigned int DILATION_SIZE = 20; 
+// History length of the default BackgroundSubtractorMOG, its learning rate
+// is 1 / min(frames seen, MOG_HISTORY)
+const unsigned int MOG_HISTORY = 200;
+
+AbandonmentDetector::AbandonmentDetector(size_t max_candidates):
+	max_candidates_ (max_candidates),
+	prev_frame_ (0),
+	model_frames_ (0),
+	evicted_candidates_ (0) {
+	erosion_element_ = getStructuringElement(MORPH_ELLIPSE, 
+	    Size(2 * EROSION_SIZE + 1, 2 * EROSION_SIZE + 1),
+	    Point(EROSION_SIZE, EROSION_SIZE));
+	dilation_element_ = getStructuringElement(MORPH_ELLIPSE, 
+	    Size(2 * DILATION_SIZE + 1, 2 * DILATION_SIZE + 1),
+	    Point(DILATION_SIZE, DILATION_SIZE));
+	candidates_.reserve(max_candidates_);
+}
+
+void AbandonmentDetector::FindBoundingRectangles() {
+	// find contours
+	Mat tmp_dilated = dilated_.clone();
+	vector<vector<Point>> contours;
+	vector<Vec4i> hierarchy;
+	findContours(tmp_dilated, contours, hierarchy, CV_RETR_EXTERNAL, 
+	    CV_CHAIN_APPROX_SIMPLE, Point(0, 0));
+
+	// find bounding rectangles
+	vector<Point> contour_poly;
+	bounding_rectangles_.clear();
+	for (unsigned int i = 0; i < contours.size(); i++) {
+		approxPolyDP(Mat(contours[i]), contour_poly, 3, true);
+		bounding_rectangles_.push_back(boundingRect(Mat(contour_poly)));
+	}
+}
+
+void AbandonmentDetector::ProcessFrame(const Mat& frame,
+    unsigned int frame_num, vector<AccumulatedObject> *pstarted,
+    vector<AccumulatedObject> *pended) {
+	assert(pstarted);
+	assert(pended);
+	unsigned int elapsed_frames = frame_num > 0 ? frame_num - prev_frame_ : 1;
+	prev_frame_ = frame_num;
+
+	// Update the background model. The default learning rate is per call,
+	// skipped frames would slow down the adaptation, so the model gets the
+	// rate of elapsed_frames updates with the same frame.
+	model_frames_ = model_frames_ > 0 ? model_frames_ + elapsed_frames : 1;
+	double learning_rate = 1.0 / std::min(model_frames_, MOG_HISTORY);
+	if (elapsed_frames > 1)
+		learning_rate = 1.0 - pow(1.0 - learning_rate, elapsed_frames);
+	mog_(frame, foreground_mask_, learning_rate);
+
+	// erode/dilate
+	erode(foreground_mask_, eroded_, erosion_element_);
+	dilate(eroded_, dilated_, dilation_element_);
+	FindBoundingRectangles();
+
+	// for each accumulated rectangle check if it appears in current frame
+	for (const Rect& bounding_rectangle : bounding_rectangles_) {
+		bool is_new_object = true;
+		for (AccumulatedObject& accum : candidates_) 
+			// if yes - update accumulator
+			if (AreAlmostSimilar(bounding_rectangle,
+			    accum.bounding_rectangle)) {
+				bool is_stable = accum.frames_count >= MIN_FRAMES;
+				accum.frames_count += elapsed_frames;
+				accum.last_frame = frame_num;
+				// report object as soon as it becomes stable
+				if (!is_stable && accum.frames_count >= MIN_FRAMES)
+					pstarted->push_back(accum);
+				is_new_object = false;
+				break;
+			}
+		// if no - it's new object. Create new accumulator for it
+		if (is_new_object && !AddCandidate(AccumulatedObject(frame_num, 1,
+		    frame_num, bounding_rectangle)))
+			evicted_candidates_++;
+	}
+
+	// delete all accumulated objects which are eliminated in this frame
+	size_t kept_count = 0;
+	for (size_t i = 0; i < candidates_.size(); i++) {
+		const AccumulatedObject& accum = candidates_[i];
+		if (accum.last_frame == frame_num) {
+			candidates_[kept_count++] = accum;
+			continue;
+		}
+		// if it has been appeared in more than MIN_FRAMES
+		// frames - it's stable object - add it to found objects
+		if (accum.frames_count >= MIN_FRAMES)
+			pended->push_back(accum);
+	}
+	// shrinking does not free the storage
+	candidates_.erase(candidates_.begin() + kept_count, candidates_.end());
+}
+
+void AbandonmentDetector::Finish(vector<AccumulatedObject> *pended) const {
+	assert(pended);
+	for (const AccumulatedObject& accum : candidates_)
+		if (accum.frames_count >= MIN_FRAMES)
+			pended->push_back(accum);
+}
+
+bool AbandonmentDetector::AddCandidate(const AccumulatedObject& candidate) {
+	if (max_candidates_ == 0 || candidates_.size() < max_candidates_) {
+		candidates_.push_back(candidate);
+		return true;
+	}
+
+	// the least promising candidate is the one seen in the fewest frames,
+	// the oldest one of them if there are several
+	size_t evicted = candidates_.size();
+	for (size_t i = 0; i < candidates_.size(); i++) {
+		if (candidates_[i].frames_count >= MIN_FRAMES)
+			continue;
+		if (evicted == candidates_.size() ||
+		    candidates_[i].frames_count <
+		    candidates_[evicted].frames_count ||
+		    (candidates_[i].frames_count ==
+		    candidates_[evicted].frames_count &&
+		    candidates_[i].last_frame < candidates_[evicted].last_frame))
+			evicted = i;
+	}
+	if (evicted != candidates_.size())
+		candidates_[evicted] = candidate;
+	return false;
+}
+
+bool AreAlmostSimilar(const Rect& bounding_rectangle1,
+    const Rect& bounding_rectangle2) {
+	if (abs(bounding_rectangle1.x - bounding_rectangle2.x) <
+	    MAX_SIMILAR_DISTANCE &&
+	    abs(bounding_rectangle1.y - bounding_rectangle2.y) <
+	    MAX_SIMILAR_DISTANCE &&
+	    abs(bounding_rectangle1.width - bounding_rectangle2.width) <
+	    MAX_SIMILAR_DISTANCE &&
+	    abs(bounding_rectangle1.height - bounding_rectangle2.height) <
+	     MAX_SIMILAR_DISTANCE) 
+		return true;
+	return false;
+}
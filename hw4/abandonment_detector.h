@@ -0,0 +1,97 @@
+// Incremental detector of abandonment objects. Frames are fed one by one, the
+// background model is updated by every frame and foreground objects whose
+// bounding rectangles stay unchanged during MIN_FRAMES frames are reported.
+// All frames of one detector must have the same size and type, since they
+// update the same background model. See report.pdf for the algorithm details.
+
+#ifndef ABANDONMENT_DETECTOR_H
+#define ABANDONMENT_DETECTOR_H
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/video/video.hpp>
+#include <stddef.h>
+#include <vector>
+
+// Algorithm detects abandonment object as objects which bounding rectangles
+// are stay unchanged during MIN_FRAMES frames of video. MAX_SIMILAR_DISTANCE
+// is the maximum deviation from the bounding rectangle appeared in the first 
+// frame. Deviations may take place because of e.g. changing lighting.
+const unsigned int MAX_SIMILAR_DISTANCE = 10;
+const unsigned int MIN_FRAMES = 40;
+
+// structure to store once appeared object information.
+struct AccumulatedObject {
+	AccumulatedObject(unsigned int appear_frame_,
+	    unsigned int frames_count_, unsigned int last_frame_,
+	    cv::Rect bounding_rectangle_):
+		appear_frame (appear_frame_),
+		frames_count (frames_count_),
+		last_frame (last_frame_),
+		bounding_rectangle (bounding_rectangle_) {}
+
+	unsigned int appear_frame; // first appearence frame
+	unsigned int frames_count; // count of continious appearence frames
+	                           // (skipped frames are counted too)
+	unsigned int last_frame;   // last frame in which the object appears
+	cv::Rect bounding_rectangle; // bounding rectangle of object
+};
+
+class AbandonmentDetector {
+public:
+	// There are at most max_candidates accumulated objects (0 means
+	// unlimited), all the storage is allocated at once
+	explicit AbandonmentDetector(size_t max_candidates = 0);
+
+	// Processes the gray or BGR frame. Frame numbers must grow, frames
+	// between two processed ones are counted as seen. Objects which become
+	// stable in this frame are appended to *pstarted, stable objects which
+	// disappear in it - to *pended.
+	void ProcessFrame(const cv::Mat& frame, unsigned int frame_num,
+	    std::vector<AccumulatedObject> *pstarted,
+	    std::vector<AccumulatedObject> *pended);
+	// Appends stable objects still present to *pended at the end of stream
+	void Finish(std::vector<AccumulatedObject> *pended) const;
+
+	// Intermediate results of the last processed frame. Foreground mask
+	// buffer is reused by the next frame.
+	const std::vector<AccumulatedObject>& Candidates() const {
+		return candidates_;
+	}
+	const std::vector<cv::Rect>& BoundingRectangles() const {
+		return bounding_rectangles_;
+	}
+	const cv::Mat& ForegroundMask() const { return foreground_mask_; }
+	const cv::Mat& Eroded() const { return eroded_; }
+	const cv::Mat& Dilated() const { return dilated_; }
+	// Count of candidates evicted or dropped because of max_candidates
+	unsigned int EvictedCandidates() const { return evicted_candidates_; }
+
+private:
+	// Adds new candidate. If there are max_candidates_ objects, evicts the
+	// least promising not stable candidate or drops the new one when all
+	// candidates are stable. Returns false if something has been evicted or
+	// dropped.
+	bool AddCandidate(const AccumulatedObject& candidate);
+	void FindBoundingRectangles();
+
+	cv::BackgroundSubtractorMOG mog_;
+	cv::Mat erosion_element_;
+	cv::Mat dilation_element_;
+	cv::Mat foreground_mask_;
+	cv::Mat eroded_;
+	cv::Mat dilated_;
+	std::vector<cv::Rect> bounding_rectangles_;
+	std::vector<AccumulatedObject> candidates_;
+	size_t max_candidates_;
+	unsigned int prev_frame_;
+	// frames covered by the background model, skipped ones included
+	unsigned int model_frames_;
+	unsigned int evicted_candidates_;
+};
+
+// Tests if two rectangles are similar (See the description
+// of MAX_SIMILAR_DISTANCE and report.pdf for detatils)
+bool AreAlmostSimilar(const cv::Rect& bounding_rectangle1,
+    const cv::Rect& bounding_rectangle2);
+
+#endif // ABANDONMENT_DETECTOR_H
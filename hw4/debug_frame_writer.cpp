@@ -0,0 +1,139 @@
+#include "debug_frame_writer.h"
+
+#include <opencv2/highgui/highgui_c.h>
+#include <stdio.h>
+
+using namespace cv;
+using std::string;
+using std::mutex;
+using std::unique_lock;
+using std::lock_guard;
+
+// Frame rate of the written debug videos
+const double DEBUG_VIDEO_FPS = 25;
+
+DebugFrameWriter::DebugFrameWriter():
+	mode_ (DEBUG_OUTPUT_NONE),
+	queue_size_ (0),
+	is_opened_ (false),
+	is_stopping_ (false),
+	is_failed_ (false),
+	dropped_count_ (0) {}
+
+DebugFrameWriter::~DebugFrameWriter() {
+	Close();
+}
+
+bool DebugFrameWriter::Open(DebugOutputMode mode, const string& output_path,
+    size_t queue_size) {
+	if (is_opened_)
+		return false;
+	// windows can be shown only from the main thread
+	if (mode != DEBUG_OUTPUT_VIDEO && mode != DEBUG_OUTPUT_IMAGES)
+		return false;
+	if (queue_size == 0 || output_path.length() == 0)
+		return false;
+
+	mode_ = mode;
+	output_path_ = output_path;
+	queue_size_ = queue_size;
+	is_stopping_ = false;
+	is_failed_ = false;
+	dropped_count_ = 0;
+	writer_thread_ = std::thread(&DebugFrameWriter::WriterLoop, this);
+	is_opened_ = true;
+	return true;
+}
+
+void DebugFrameWriter::Push(const DebugFrame& frame) {
+	if (!is_opened_ || is_failed_)
+		return;
+	// the writer thread uses video writers only after they are opened here
+	if (mode_ == DEBUG_OUTPUT_VIDEO && !frame_writer_.isOpened() &&
+	    !OpenVideo(frame)) {
+		is_failed_ = true;
+		return;
+	}
+	{
+		lock_guard<mutex> lock(queue_mutex_);
+		if (queue_.size() >= queue_size_) {
+			queue_.pop_front();
+			dropped_count_++;
+		}
+		queue_.push_back(frame);
+	}
+	queue_not_empty_.notify_one();
+}
+
+void DebugFrameWriter::Close() {
+	if (!is_opened_)
+		return;
+	{
+		lock_guard<mutex> lock(queue_mutex_);
+		is_stopping_ = true;
+	}
+	queue_not_empty_.notify_one();
+	writer_thread_.join();
+
+	frame_writer_.release();
+	mask_writer_.release();
+	is_opened_ = false;
+}
+
+bool DebugFrameWriter::OpenVideo(const DebugFrame& frame) {
+	string mask_path = output_path_;
+	size_t dot = mask_path.rfind('.');
+	if (dot == string::npos)
+		dot = mask_path.length();
+	mask_path.insert(dot, "_mask");
+
+	// three masks are written side by side
+	Size masks_size(3 * frame.foreground_mask_mog.cols,
+	    frame.foreground_mask_mog.rows);
+	return frame_writer_.open(output_path_, CV_FOURCC('M', 'J', 'P', 'G'),
+	    DEBUG_VIDEO_FPS, frame.annotated.size(), true) &&
+	    mask_writer_.open(mask_path, CV_FOURCC('M', 'J', 'P', 'G'),
+	    DEBUG_VIDEO_FPS, masks_size, false);
+}
+
+void DebugFrameWriter::WriterLoop() {
+	while (true) {
+		DebugFrame frame;
+		{
+			unique_lock<mutex> lock(queue_mutex_);
+			while (queue_.empty() && !is_stopping_)
+				queue_not_empty_.wait(lock);
+			// queue is drained before stopping
+			if (queue_.empty())
+				return;
+			frame = queue_.front();
+			queue_.pop_front();
+		}
+		// frames queued before the failure are dropped
+		if (!is_failed_)
+			Write(frame);
+	}
+}
+
+void DebugFrameWriter::Write(const DebugFrame& frame) {
+	// all three masks are written side by side as one picture
+	Mat masks, tmp_masks;
+	hconcat(frame.foreground_mask_mog, frame.eroded, tmp_masks);
+	hconcat(tmp_masks, frame.dilated, masks);
+
+	if (mode_ == DEBUG_OUTPUT_IMAGES) {
+		char file_name[32] = {0};
+		sprintf(file_name, "_%06u_frame.png", frame.frame_num);
+		bool is_written = imwrite(output_path_ + file_name,
+		    frame.annotated);
+		sprintf(file_name, "_%06u_mask.png", frame.frame_num);
+		is_written = imwrite(output_path_ + file_name, masks) &&
+		    is_written;
+		if (!is_written)
+			is_failed_ = true;
+		return;
+	}
+
+	frame_writer_.write(frame.annotated);
+	mask_writer_.write(masks);
+}
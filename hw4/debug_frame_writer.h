@@ -0,0 +1,82 @@
+// Asynchronous writer of the annotated debug frames. The analysis loop only
+// pushes frames to the bounded queue and never waits for the disk: if the
+// writer thread falls behind, the oldest queued frames are dropped. Video
+// files are opened by the first pushed frame, as their sizes are unknown
+// before; once any output cannot be opened or written the writer fails and
+// takes no more frames.
+
+#ifndef DEBUG_FRAME_WRITER_H
+#define DEBUG_FRAME_WRITER_H
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Where the debug output goes
+enum DebugOutputMode {
+	DEBUG_OUTPUT_NONE,      // no debug output at all (default)
+	DEBUG_OUTPUT_WINDOWS,   // interactive highgui windows
+	DEBUG_OUTPUT_VIDEO,     // annotated frame and mask videos
+	DEBUG_OUTPUT_IMAGES     // numbered image sequence
+};
+
+// One frame of the debug output: frame with all drawn rectangles and the
+// foreground masks after each step of processing
+struct DebugFrame {
+	unsigned int frame_num;
+	cv::Mat annotated;
+	cv::Mat foreground_mask_mog;
+	cv::Mat eroded;
+	cv::Mat dilated;
+};
+
+class DebugFrameWriter {
+public:
+	DebugFrameWriter();
+	~DebugFrameWriter();
+
+	// Starts the writer thread. For DEBUG_OUTPUT_VIDEO output_path is the
+	// annotated video file name, the masks go to the file with "_mask"
+	// suffix. For DEBUG_OUTPUT_IMAGES output_path is the prefix of the
+	// image file names.
+	bool Open(DebugOutputMode mode, const std::string& output_path,
+	    size_t queue_size);
+	// Enqueues frame, drops the oldest queued one if the queue is full.
+	// Does nothing once the writer has failed.
+	void Push(const DebugFrame& frame);
+	// Writes all queued frames and stops the writer thread
+	void Close();
+
+	bool IsOpened() const { return is_opened_; }
+	// Tells whether some output file could not be opened or written
+	bool IsFailed() const { return is_failed_; }
+	size_t DroppedCount() const { return dropped_count_; }
+
+private:
+	bool OpenVideo(const DebugFrame& frame);
+	void WriterLoop();
+	void Write(const DebugFrame& frame);
+
+	DebugOutputMode mode_;
+	std::string output_path_;
+	size_t queue_size_;
+	bool is_opened_;
+	bool is_stopping_;
+	std::atomic<bool> is_failed_;
+	size_t dropped_count_;
+
+	std::deque<DebugFrame> queue_;
+	std::mutex queue_mutex_;
+	std::condition_variable queue_not_empty_;
+	std::thread writer_thread_;
+
+	cv::VideoWriter frame_writer_;
+	cv::VideoWriter mask_writer_;
+};
+
+#endif // DEBUG_FRAME_WRITER_H
@@ -0,0 +1,200 @@
+#include "event_stream.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <chrono>
+#include <sstream>
+
+using std::string;
+using std::stringstream;
+using std::mutex;
+using std::unique_lock;
+using std::lock_guard;
+using std::deque;
+
+FileEventSink::FileEventSink(): file_ (NULL) {}
+
+FileEventSink::~FileEventSink() {
+	if (file_ && file_ != stdout)
+		fclose(file_);
+}
+
+bool FileEventSink::Open(const string& file_name) {
+	if (file_name == "-")
+		file_ = stdout;
+	else
+		file_ = fopen(file_name.c_str(), "a");
+	return file_ != NULL;
+}
+
+bool FileEventSink::Write(const string& data) {
+	if (!file_)
+		return false;
+	if (fwrite(data.data(), 1, data.size(), file_) != data.size())
+		return false;
+	return fflush(file_) == 0;
+}
+
+UnixSocketEventSink::UnixSocketEventSink(): fd_ (-1) {}
+
+UnixSocketEventSink::~UnixSocketEventSink() {
+	if (fd_ != -1)
+		close(fd_);
+}
+
+bool UnixSocketEventSink::Connect(const string& socket_path) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socket_path.length() >= sizeof(address.sun_path))
+		return false;
+	strcpy(address.sun_path, socket_path.c_str());
+
+	fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd_ == -1)
+		return false;
+	if (connect(fd_, (sockaddr*) &address, sizeof(address)) == -1) {
+		close(fd_);
+		fd_ = -1;
+		return false;
+	}
+	return true;
+}
+
+bool UnixSocketEventSink::Write(const string& data) {
+	if (fd_ == -1)
+		return false;
+	size_t written = 0;
+	while (written < data.size()) {
+		ssize_t ret = send(fd_, data.data() + written,
+		    data.size() - written, MSG_NOSIGNAL);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		written += ret;
+	}
+	return true;
+}
+
+EventStream::EventStream():
+	queue_size_ (0),
+	is_opened_ (false),
+	is_stopping_ (false),
+	dropped_count_ (0) {}
+
+EventStream::~EventStream() {
+	Close();
+}
+
+bool EventStream::Open(std::unique_ptr<EventSink> sink, size_t queue_size) {
+	if (is_opened_ || !sink || queue_size == 0)
+		return false;
+	sink_ = std::move(sink);
+	queue_size_ = queue_size;
+	is_stopping_ = false;
+	dropped_count_ = 0;
+	writer_thread_ = std::thread(&EventStream::WriterLoop, this);
+	is_opened_ = true;
+	return true;
+}
+
+void EventStream::Push(AbandonmentEvent event) {
+	if (!is_opened_)
+		return;
+	event.time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+	    std::chrono::system_clock::now().time_since_epoch()).count();
+	{
+		lock_guard<mutex> lock(queue_mutex_);
+		if (queue_.size() >= queue_size_) {
+			queue_.pop_front();
+			dropped_count_++;
+		}
+		queue_.push_back(event);
+	}
+	queue_not_empty_.notify_one();
+}
+
+void EventStream::Close() {
+	if (!is_opened_)
+		return;
+	{
+		lock_guard<mutex> lock(queue_mutex_);
+		is_stopping_ = true;
+	}
+	queue_not_empty_.notify_one();
+	writer_thread_.join();
+	sink_.reset();
+	is_opened_ = false;
+	if (dropped_count_ > 0)
+		fprintf(stderr, "%zu abandonment events dropped\n", dropped_count_);
+}
+
+void EventStream::WriterLoop() {
+	bool is_sink_failed = false;
+	while (true) {
+		deque<AbandonmentEvent> batch;
+		{
+			unique_lock<mutex> lock(queue_mutex_);
+			while (queue_.empty() && !is_stopping_)
+				queue_not_empty_.wait(lock);
+			// queue is drained before stopping
+			if (queue_.empty())
+				return;
+			batch.swap(queue_);
+		}
+
+		// report broken sink once, events are dropped after that
+		if (is_sink_failed)
+			continue;
+		string data;
+		for (const AbandonmentEvent& event : batch)
+			data += ToJson(event);
+		if (!sink_->Write(data)) {
+			fprintf(stderr, "Cannot write abandonment events\n");
+			is_sink_failed = true;
+		}
+	}
+}
+
+string EventStream::ToJson(const AbandonmentEvent& event) {
+	string video;
+	for (char c : event.video) {
+		if (c == '"' || c == '\\') {
+			video += '\\';
+			video += c;
+		}
+		else if (c == '\n')
+			video += "\\n";
+		else if (c == '\t')
+			video += "\\t";
+		else if (c == '\r')
+			video += "\\r";
+		else if ((unsigned char) c < 0x20) {
+			// the rest of control characters have no short escapes
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			video += escaped;
+		}
+		else
+			video += c;
+	}
+
+	stringstream ss;
+	ss << "{\"event\": \"" <<
+	    (event.type == AbandonmentEvent::BEGIN ? "begin" : "end") <<
+	    "\", \"time_ms\": " << event.time_ms <<
+	    ", \"video\": \"" << video << "\"" <<
+	    ", \"appear_frame\": " << event.appear_frame <<
+	    ", \"last_frame\": " << event.last_frame <<
+	    ", \"rectangle\": [" <<
+	    event.bounding_rectangle.x << ", " <<
+	    event.bounding_rectangle.y << ", " <<
+	    event.bounding_rectangle.width << ", " <<
+	    event.bounding_rectangle.height << "]}\n";
+	return ss.str();
+}
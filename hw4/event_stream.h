@@ -0,0 +1,97 @@
+// Streaming output of the abandonment detections. Events are pushed by the
+// processing loop and written by the background thread as newline-delimited
+// JSON: all events queued while the previous write was in progress go to the
+// sink with one write call. If the sink is too slow, the oldest queued events
+// are dropped.
+
+#ifndef EVENT_STREAM_H
+#define EVENT_STREAM_H
+
+#include <opencv2/core/core.hpp>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct AbandonmentEvent {
+	enum Type {
+		BEGIN, // object has been stable for MIN_FRAMES frames
+		END    // object disappeared or the video is over
+	};
+
+	Type type;
+	std::string video;
+	unsigned int appear_frame;
+	unsigned int last_frame;
+	cv::Rect bounding_rectangle;
+	long long time_ms; // detection wall clock time, set by EventStream::Push
+};
+
+// Destination of the serialized events
+class EventSink {
+public:
+	virtual ~EventSink() {}
+	virtual bool Write(const std::string& data) = 0;
+};
+
+// Writes events to the file, "-" stands for stdout
+class FileEventSink : public EventSink {
+public:
+	FileEventSink();
+	~FileEventSink();
+	bool Open(const std::string& file_name);
+	bool Write(const std::string& data);
+
+private:
+	FILE* file_;
+};
+
+// Writes events to the listening local (Unix domain) stream socket
+class UnixSocketEventSink : public EventSink {
+public:
+	UnixSocketEventSink();
+	~UnixSocketEventSink();
+	bool Connect(const std::string& socket_path);
+	bool Write(const std::string& data);
+
+private:
+	int fd_;
+};
+
+class EventStream {
+public:
+	EventStream();
+	~EventStream();
+
+	// Starts the writer thread, stream takes ownership of the sink. At most
+	// queue_size events wait for the write.
+	bool Open(std::unique_ptr<EventSink> sink, size_t queue_size);
+	// Timestamps and enqueues event, drops the oldest queued one if the
+	// queue is full. Returns immediately.
+	void Push(AbandonmentEvent event);
+	// Writes all queued events and stops the writer thread, reports dropped
+	// events
+	void Close();
+
+	bool IsOpened() const { return is_opened_; }
+	size_t DroppedCount() const { return dropped_count_; }
+
+private:
+	void WriterLoop();
+	static std::string ToJson(const AbandonmentEvent& event);
+
+	std::unique_ptr<EventSink> sink_;
+	size_t queue_size_;
+	bool is_opened_;
+	bool is_stopping_;
+	size_t dropped_count_;
+
+	std::deque<AbandonmentEvent> queue_;
+	std::mutex queue_mutex_;
+	std::condition_variable queue_not_empty_;
+	std::thread writer_thread_;
+};
+
+#endif // EVENT_STREAM_H
@@ -0,0 +1,105 @@
+#include "frame_source.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui_c.h>
+
+using namespace cv;
+using std::string;
+
+// Probability of the new object to be left on the synthetic scene per frame
+const double SYNTHETIC_OBJECT_RATE = 0.01;
+// Synthetic objects stay on the scene from MIN to MAX frames
+const unsigned int SYNTHETIC_OBJECT_MIN_FRAMES = 20;
+const unsigned int SYNTHETIC_OBJECT_MAX_FRAMES = 400;
+// Count of noise blobs flickering on every synthetic frame
+const unsigned int SYNTHETIC_NOISE_BLOBS = 30;
+
+bool VideoFileSource::Open(const string& filename, bool is_luma_only) {
+	if (!capture_.open(filename))
+		return false;
+	// the backends not supporting the property keep returning BGR, the
+	// result is not checked as the format is known from the frames only
+	if (is_luma_only)
+		capture_.set(CV_CAP_PROP_CONVERT_RGB, 0);
+	return true;
+}
+
+bool VideoFileSource::Grab() {
+	return capture_.grab();
+}
+
+bool VideoFileSource::Retrieve(Mat *pframe) {
+	assert(pframe);
+	return capture_.retrieve(*pframe);
+}
+
+bool VideoFileSource::Seek(unsigned int frame_num) {
+	return capture_.set(CV_CAP_PROP_POS_FRAMES, frame_num);
+}
+
+unsigned int VideoFileSource::Position() {
+	double position = capture_.get(CV_CAP_PROP_POS_FRAMES);
+	return position > 0 ? (unsigned int) position : 0;
+}
+
+unsigned int VideoFileSource::FramesCount() {
+	double frames_count = capture_.get(CV_CAP_PROP_FRAME_COUNT);
+	return frames_count > 0 ? (unsigned int) frames_count : 0;
+}
+
+SyntheticFrameSource::SyntheticFrameSource(unsigned long long frames_count,
+    Size size, unsigned int seed):
+	frames_count_ (frames_count),
+	frame_num_ (0),
+	size_ (size),
+	rng_ (seed),
+	background_ (size, CV_8UC3) {
+	rng_.fill(background_, RNG::UNIFORM, Scalar::all(80),
+	    Scalar::all(120));
+}
+
+bool SyntheticFrameSource::Grab() {
+	if (frame_num_ >= frames_count_)
+		return false;
+	frame_num_++;
+
+	for (size_t i = 0; i < objects_.size();)
+		if (objects_[i].disappear_frame <= frame_num_) {
+			objects_[i] = objects_.back();
+			objects_.pop_back();
+		}
+		else
+			i++;
+
+	if (rng_.uniform(0.0, 1.0) < SYNTHETIC_OBJECT_RATE) {
+		SceneObject object;
+		int width = rng_.uniform(10, size_.width / 4);
+		int height = rng_.uniform(10, size_.height / 4);
+		object.rectangle = Rect(rng_.uniform(0, size_.width - width),
+		    rng_.uniform(0, size_.height - height), width, height);
+		object.color = Scalar(rng_.uniform(0, 256),
+		    rng_.uniform(0, 256), rng_.uniform(0, 256));
+		object.disappear_frame = frame_num_ + rng_.uniform(
+		    (int) SYNTHETIC_OBJECT_MIN_FRAMES,
+		    (int) SYNTHETIC_OBJECT_MAX_FRAMES);
+		objects_.push_back(object);
+	}
+	return true;
+}
+
+bool SyntheticFrameSource::Retrieve(Mat *pframe) {
+	assert(pframe);
+	if (frame_num_ == 0)
+		return false;
+
+	background_.copyTo(*pframe);
+	for (const SceneObject& object : objects_)
+		rectangle(*pframe, object.rectangle, object.color, -1);
+	for (unsigned int i = 0; i < SYNTHETIC_NOISE_BLOBS; i++) {
+		Point center(rng_.uniform(0, size_.width),
+		    rng_.uniform(0, size_.height));
+		circle(*pframe, center, rng_.uniform(1, 6),
+		    Scalar::all(rng_.uniform(0, 256)), -1);
+	}
+	return true;
+}
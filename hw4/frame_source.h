@@ -0,0 +1,68 @@
+// Sources of the frames for the abandonment objects detector
+
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <string>
+#include <vector>
+
+class FrameSource {
+public:
+	virtual ~FrameSource() {}
+	// Moves to the next frame, returns false at the end of the stream
+	virtual bool Grab() = 0;
+	// Gets the last grabbed frame
+	virtual bool Retrieve(cv::Mat *pframe) = 0;
+	// Count of frames the source has lost just before the grabbed one
+	virtual unsigned int LostFrames() const { return 0; }
+};
+
+// Frames decoded from the video file
+class VideoFileSource : public FrameSource {
+public:
+	// If is_luma_only is set the capture is asked for the frames without
+	// the conversion to BGR. Only camera backends (V4L) return raw YUYV
+	// then, the FFmpeg backend of video files ignores it and still decodes
+	// to BGR, the caller has to convert such frames to gray.
+	bool Open(const std::string& filename, bool is_luma_only);
+	bool Grab();
+	bool Retrieve(cv::Mat *pframe);
+	// Moves to the frame. Most backends stop at the keyframe preceding
+	// frame_num, Position tells where the source actually is.
+	bool Seek(unsigned int frame_num);
+	// Number of the frame the next Grab moves to
+	unsigned int Position();
+	// Count of frames reported by the container, 0 if unknown
+	unsigned int FramesCount();
+
+private:
+	cv::VideoCapture capture_;
+};
+
+// Generated scene for soak tests: static background, objects which are left
+// on the scene for a random time and a lot of short living noise blobs
+class SyntheticFrameSource : public FrameSource {
+public:
+	SyntheticFrameSource(unsigned long long frames_count, cv::Size size,
+	    unsigned int seed);
+	bool Grab();
+	bool Retrieve(cv::Mat *pframe);
+
+private:
+	struct SceneObject {
+		cv::Rect rectangle;
+		cv::Scalar color;
+		unsigned long long disappear_frame;
+	};
+
+	unsigned long long frames_count_;
+	unsigned long long frame_num_;
+	cv::Size size_;
+	cv::RNG rng_;
+	cv::Mat background_;
+	std::vector<SceneObject> objects_;
+};
+
+#endif // FRAME_SOURCE_H
@@ -5,11 +5,22 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/highgui/highgui_c.h>
-#include <opencv2/video/video.hpp>
 #include <stdio.h>
+#include <stdlib.h>
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+#include "abandonment_detector.h"
+#include "debug_frame_writer.h"
+#include "event_stream.h"
+#include "frame_source.h"
+#include "memory_usage.h"
+#include "shm_frame_ring.h"
 
 using namespace cv;
 using std::vector;
@@ -18,55 +29,230 @@ using std::stringstream;
 using std::ifstream;
 using std::cerr;
 using std::cout;
-using std::list;
-
-// Comment next line if you want to run program without visualization
-#define VISUALIZATION 1
-
-// Algorithm detects abandonment object as objects which bounding rectangles
-// are stay unchanged during MIN_FRAMES frames of video. MAX_SIMILAR_DISTANCE
-// is the maximum deviation from the bounding rectangle appeared in the first 
-// frame. Deviations may take place because of e.g. changing lighting.
-const unsigned int MAX_SIMILAR_DISTANCE = 10;
-const unsigned int MIN_FRAMES = 40;
-// To remove noise from the foreground we use erosion with the EROSION_SIZE radius
-const unsigned int EROSION_SIZE = 2; 
-// To connect somehow disconnected parts of one object we use dilation with the
-// DILATION_DIZE radius
-const unsigned int DILATION_SIZE = 20; 
-
-// structure to store once appeared object information.
-struct AccumulatedObject {
-	AccumulatedObject(unsigned int appear_frame_,
-	    unsigned int frames_count_, unsigned int last_frame_,
-	    Rect bounding_rectangle_):
-		appear_frame (appear_frame_),
-		frames_count (frames_count_),
-		last_frame (last_frame_),
-		bounding_rectangle (bounding_rectangle_) {}
-
-	unsigned int appear_frame; // first appearence frame
-	unsigned int frames_count; // count of continious appearence frames
-	unsigned int last_frame;   // last frame in which the object appears
-	Rect bounding_rectangle;   // bounding rectangle of object
+
+// Debug frames which are not written yet are dropped when there are more than
+// DEBUG_QUEUE_SIZE of them, so the debug output never slows down processing
+const size_t DEBUG_QUEUE_SIZE = 64;
+// At most EVENTS_QUEUE_SIZE events wait for the slow events output, the
+// older ones are dropped
+const size_t EVENTS_QUEUE_SIZE = 1024;
+// In adaptive rate mode the scene is static if the mean absolute difference of
+// gray frames downscaled MOTION_DOWNSCALE times is below MOTION_THRESHOLD
+const unsigned int MOTION_DOWNSCALE = 8;
+const double MOTION_THRESHOLD = 2.0;
+// Count of gaussians per pixel in the default BackgroundSubtractorMOG. Every
+// gaussian keeps weight, mean and variance per channel as floats.
+const unsigned int MOG_MIXTURES = 5;
+// In long running mode there are at most MAX_CANDIDATES accumulated objects,
+// the one with the least frames count is evicted to make room for a new one
+const size_t MAX_CANDIDATES = 256;
+// Soak test scene: frame rate used to convert hours to frames, frame size and
+// how often (in frames) the memory usage is reported
+const unsigned int SOAK_FPS = 25;
+const int SOAK_FRAME_WIDTH = 320;
+const int SOAK_FRAME_HEIGHT = 240;
+const unsigned long long SOAK_REPORT_PERIOD = SOAK_FPS * 600;
+// In sharded mode every shard updates its background model by
+// SHARD_WARMUP_FRAMES frames preceding its range before detecting objects
+const unsigned int SHARD_WARMUP_FRAMES = 500;
+// Background models of the shards differ from the serial one at the start
+// of the shard ranges, so timespans of the objects found by the sharded and
+// by the serial run are compared with this tolerance (in frames)
+const unsigned int SHARD_FRAME_TOLERANCE = MIN_FRAMES;
+
+// Reference run to compare the processing results with
+enum CompareMode {
+	COMPARE_NONE,
+	COMPARE_FULL_RATE, // the same options without frame skipping
+	COMPARE_COLOR,     // the same options with BGR input
+	COMPARE_SERIAL     // the same options without sharding
+};
+
+// Run-time options of the video processing
+struct ProcessingOptions {
+	ProcessingOptions():
+		debug_output_mode (DEBUG_OUTPUT_NONE),
+		debug_queue_size (DEBUG_QUEUE_SIZE),
+		max_frame_step (1),
+		is_luma_only (false),
+		compare_mode (COMPARE_NONE),
+		is_long_running (false),
+		max_candidates (0),
+		memory_report_period (0),
+		soak_hours (0),
+		shards_count (1),
+		shard_warmup_frames (SHARD_WARMUP_FRAMES),
+		is_events_to_socket (false),
+		pevents (NULL),
+		presults (&cout) {}
+
+	DebugOutputMode debug_output_mode;
+	string debug_output_path; // file name or prefix, see DebugFrameWriter
+	size_t debug_queue_size;  // max count of frames waiting to be written
+
+	// Static scene is processed only every max_frame_step-th frame, any
+	// motion returns to processing of every frame. 1 disables skipping.
+	unsigned int max_frame_step;
+	// MOG and the rest of pipeline work on the luma only, not on BGR. Video
+	// files are still decoded to BGR and converted to gray, so decoding
+	// costs the same.
+	bool is_luma_only;
+	// also run with the reference options and compare results
+	CompareMode compare_mode;
+
+	// Found objects are printed at once instead of being collected
+	bool is_long_running;
+	// accumulator is capped by max_candidates, 0 - unlimited (MAX_CANDIDATES
+	// in long running mode unless given)
+	size_t max_candidates;
+	// print memory usage every memory_report_period frames, 0 - never
+	unsigned long long memory_report_period;
+	// run on the synthetic scene of this duration instead of test videos
+	double soak_hours;
+	// read frames from the shared memory ring instead of test videos
+	string shm_name;
+	// Every video is split into shards_count time shards processed
+	// concurrently. Debug output and events are not produced in this mode.
+	unsigned int shards_count;
+	unsigned int shard_warmup_frames;
+
+	string events_path;       // events file ("-" for stdout) or socket path
+	bool is_events_to_socket;
+	EventStream *pevents;     // stream opened from events_path, if any
+	// Human readable results. They go to stderr when events go to stdout,
+	// so the events stream is not broken by them.
+	std::ostream *presults;
+};
+
+// Counters of the work done by ProcessVideo. Frames are counted in the owned
+// range only, so the shards of a video sum up to its frames count.
+struct ProcessingStats {
+	ProcessingStats():
+		total_frames (0),
+		processed_frames (0),
+		converted_frames (0),
+		evicted_candidates (0),
+		mog_bytes (0),
+		seconds (0) {}
+
+	unsigned int total_frames;
+	unsigned int processed_frames;
+	unsigned int converted_frames; // luma frames converted from BGR
+	unsigned int evicted_candidates;
+	double mog_bytes; // estimated memory traffic of background subtraction
+	double seconds;
+};
+
+// Frames of the source and the part of them whose objects are found. Past
+// end the source is read only to follow objects appeared in [begin, end)
+// until they disappear. The default range is the whole stream.
+struct FrameRange {
+	FrameRange():
+		first (0),
+		begin (0),
+		end (std::numeric_limits<unsigned int>::max()) {}
+
+	bool Owns(const AccumulatedObject& object) const {
+		return Owns(object.appear_frame);
+	}
+	bool Owns(unsigned int frame_num) const {
+		return frame_num >= begin && frame_num < end;
+	}
+
+	unsigned int first; // number of the first frame of the source
+	unsigned int begin;
+	unsigned int end;
 };
 
 // Main function processing the video file. See report.pdf for the algoright details
-bool ProcessVideo(string filename, vector<AccumulatedObject> *paccum);
+bool ProcessVideo(string filename, const ProcessingOptions& options,
+    vector<AccumulatedObject> *paccum, ProcessingStats *pstats = NULL);
+// Processes the video split into time shards concurrently, merges objects
+// found by the shards
+bool ProcessVideoSharded(const string& filename,
+    const ProcessingOptions& options, vector<AccumulatedObject> *pfound_objects,
+    ProcessingStats *pstats);
+// Processes frames [begin, end) of the video, see ProcessVideoSharded
+bool ProcessShard(const string& filename, const ProcessingOptions& options,
+    unsigned int begin, unsigned int end,
+    vector<AccumulatedObject> *pfound_objects, ProcessingStats *pstats);
+// Merges objects found by the consecutive shards
+void MergeShardObjects(const vector<vector<AccumulatedObject> >& shard_objects,
+    vector<AccumulatedObject> *pfound_objects);
+// Converts the frame to the luma if options require it. Returns true if the
+// source has returned BGR and the luma was computed from it.
+bool PrepareFrame(const ProcessingOptions& options, Mat *pframe);
+// Processes frames of the source, name identifies the stream in the output.
+// Returns false if the debug output cannot be opened or written.
+bool ProcessFrames(FrameSource& source, const string& name,
+    const ProcessingOptions& options, const FrameRange& range,
+    vector<AccumulatedObject> *paccum, ProcessingStats *pstats = NULL);
+// Runs long running mode on the synthetic scene and reports memory usage
+bool RunSoakTest(double hours, const ProcessingOptions& options);
+// Processes frames published to the shared memory ring by the producer process
+bool ProcessSharedMemoryRing(const ProcessingOptions& options);
+// Prints found object as a part of the results line
+void PrintObject(std::ostream& out, const AccumulatedObject& obj);
+// Returns next frame step of adaptive rate mode given the motion between
+// current and previous processed frames
+unsigned int NextFrameStep(const Mat& frame, Mat *pprev_small_frame,
+    unsigned int frame_step, unsigned int max_frame_step);
+// Runs the video with the chosen options and with the reference ones (full
+// frame rate, color input or serial processing) and prints saved work and the
+// part of reference detections found
+bool CompareWithReference(const string& filename,
+    const ProcessingOptions& options);
+// Parses command line options, returns false on unknown or invalid option
+bool ParseArguments(int argc, char* argv[], ProcessingOptions *poptions);
+// Makes the name of debug output for the video from the user given prefix
+string DebugOutputPath(const ProcessingOptions& options, const string& filename);
+// Opens the event stream with the sink chosen by the options
+bool OpenEventStream(const ProcessingOptions& options, EventStream *pevents);
+// Sends begin or end event of the stable object to the event stream
+void PushEvent(EventStream *pevents, AbandonmentEvent::Type type,
+    const string& filename, const AccumulatedObject& object);
 // Reads inpt sample from the input file
 bool ReadTestFile(string filename, vector<string> *ptest_files);
-// Tests if two rectangles are similar (See the description
-// of MAX_SIMILAR_DISTANCE and report.pdf for detatils)
-bool AreAlmostSimilar(Rect& bounding_rectangle1, Rect& bounding_rectangle2);
-// Visualize current state of processing with all intermediate steps
-void VisualizeVideoProcessing(const Mat& frame, const Mat& foreground_mask_mog,
-    const Mat& eroded, const Mat& dilated, VideoCapture& capture,
+// Draws current state of processing on the copy of the frame
+Mat DrawProcessingState(const Mat& frame, unsigned int frame_num,
     const vector<Rect>& bounding_rectangles, 
-    const list<AccumulatedObject>& objects_accumulator,
+    const vector<AccumulatedObject>& objects_accumulator,
     const vector<AccumulatedObject>& found_objects); 
+// Visualize current state of processing with all intermediate steps
+void ShowProcessingState(const DebugFrame& debug_frame);
 
 int main(int argc, char* argv[])
 {
+	ProcessingOptions options;
+	if (!ParseArguments(argc, argv, &options)) {
+		cerr << "Usage: " << argv[0] << " [--show | --debug-video prefix |"
+		    " --debug-images prefix] [--debug-queue size]"
+		    " [--events file | --events-socket path]"
+		    " [--adaptive-rate max_step] [--luma]"
+		    " [--compare-full-rate | --compare-color]"
+		    " [--long-running [--max-candidates count]"
+		    " [--memory-report frames]] [--soak hours | --shm name]"
+		    " [--shards count [--shard-warmup frames] [--compare-serial]]\n";
+		return -1;
+	}
+
+	EventStream events;
+	if (options.events_path.length() > 0) {
+		if (!OpenEventStream(options, &events)) {
+			cerr << "Cannot open events output " << options.events_path
+			    << "\n";
+			return -1;
+		}
+		options.pevents = &events;
+		if (!options.is_events_to_socket && options.events_path == "-")
+			options.presults = &cerr;
+	}
+
+	if (options.soak_hours > 0)
+		return RunSoakTest(options.soak_hours, options) ? 0 : -1;
+	if (options.shm_name.length() > 0)
+		return ProcessSharedMemoryRing(options) ? 0 : -1;
+
 	vector<string> test_files;
 	if (!ReadTestFile("test_sample.txt", &test_files)) {
 		cerr << "Cannot read sample from file!\n";
@@ -74,22 +260,30 @@ int main(int argc, char* argv[])
 	}
 
 	for (string& filename : test_files) {
+		if (options.compare_mode != COMPARE_NONE) {
+			if (!CompareWithReference(filename, options)) {
+				cerr << "Error opening video from test sample";
+				return -1;
+			}
+			continue;
+		}
+
 		vector<AccumulatedObject> found_objects;
-		if (!ProcessVideo(filename, &found_objects)) {
+		ProcessingOptions video_options = options;
+		video_options.debug_output_path = DebugOutputPath(options, filename);
+		if (!ProcessVideo(filename, video_options, &found_objects)) {
 			cerr << "Error opening video from test sample";
 			return -1;
 		}
-		cout << filename << ": ";
-		for (const AccumulatedObject& obj : found_objects) {
-			cout << "rectangle: (" <<
-			    obj.bounding_rectangle.x << ", " << 
-			    obj.bounding_rectangle.y << ", " <<
-			    obj.bounding_rectangle.width << ", " << 
-			    obj.bounding_rectangle.height << ") - " <<
-			    "timespan: (" << obj.appear_frame << ", " <<
-			    obj.last_frame << ")";
-		}
-		cout << std::endl;
+		// in long running mode objects are already printed unless the
+		// video is sharded
+		if (options.is_long_running && options.shards_count == 1)
+			continue;
+		std::ostream& results = *options.presults;
+		results << filename << ": ";
+		for (const AccumulatedObject& obj : found_objects)
+			PrintObject(results, obj);
+		results << std::endl;
 	}
 
 
@@ -97,6 +291,131 @@ int main(int argc, char* argv[])
 }
 
 
+bool ParseArguments(int argc, char* argv[], ProcessingOptions *poptions) {
+	assert(poptions);
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--show")
+			poptions->debug_output_mode = DEBUG_OUTPUT_WINDOWS;
+		else if (arg == "--debug-video" && i + 1 < argc) {
+			poptions->debug_output_mode = DEBUG_OUTPUT_VIDEO;
+			poptions->debug_output_path = argv[++i];
+		}
+		else if (arg == "--debug-images" && i + 1 < argc) {
+			poptions->debug_output_mode = DEBUG_OUTPUT_IMAGES;
+			poptions->debug_output_path = argv[++i];
+		}
+		else if (arg == "--events" && i + 1 < argc) {
+			poptions->events_path = argv[++i];
+			poptions->is_events_to_socket = false;
+		}
+		else if (arg == "--events-socket" && i + 1 < argc) {
+			poptions->events_path = argv[++i];
+			poptions->is_events_to_socket = true;
+		}
+		else if (arg == "--adaptive-rate" && i + 1 < argc) {
+			poptions->max_frame_step = atoi(argv[++i]);
+			if (poptions->max_frame_step == 0)
+				return false;
+		}
+		else if (arg == "--luma")
+			poptions->is_luma_only = true;
+		else if (arg == "--compare-full-rate")
+			poptions->compare_mode = COMPARE_FULL_RATE;
+		else if (arg == "--compare-color")
+			poptions->compare_mode = COMPARE_COLOR;
+		else if (arg == "--compare-serial")
+			poptions->compare_mode = COMPARE_SERIAL;
+		else if (arg == "--shards" && i + 1 < argc) {
+			poptions->shards_count = atoi(argv[++i]);
+			if (poptions->shards_count == 0)
+				return false;
+		}
+		else if (arg == "--shard-warmup" && i + 1 < argc)
+			poptions->shard_warmup_frames = atoi(argv[++i]);
+		else if (arg == "--long-running")
+			poptions->is_long_running = true;
+		else if (arg == "--max-candidates" && i + 1 < argc) {
+			poptions->max_candidates = atoi(argv[++i]);
+			if (poptions->max_candidates == 0)
+				return false;
+		}
+		else if (arg == "--memory-report" && i + 1 < argc)
+			poptions->memory_report_period = atoll(argv[++i]);
+		else if (arg == "--soak" && i + 1 < argc) {
+			poptions->soak_hours = atof(argv[++i]);
+			if (poptions->soak_hours <= 0)
+				return false;
+		}
+		else if (arg == "--shm" && i + 1 < argc)
+			poptions->shm_name = argv[++i];
+		else if (arg == "--debug-queue" && i + 1 < argc) {
+			poptions->debug_queue_size = atoi(argv[++i]);
+			if (poptions->debug_queue_size == 0)
+				return false;
+		}
+		else
+			return false;
+	}
+	// full rate reference of a full rate run, color reference of a color run
+	// and serial reference of a serial run would compare the run with itself
+	if (poptions->compare_mode == COMPARE_FULL_RATE &&
+	    poptions->max_frame_step == 1)
+		return false;
+	if (poptions->compare_mode == COMPARE_COLOR && !poptions->is_luma_only)
+		return false;
+	if (poptions->compare_mode == COMPARE_SERIAL &&
+	    poptions->shards_count == 1)
+		return false;
+	if ((poptions->is_long_running || poptions->soak_hours > 0) &&
+	    poptions->max_candidates == 0)
+		poptions->max_candidates = MAX_CANDIDATES;
+	return true;
+}
+
+string DebugOutputPath(const ProcessingOptions& options, const string& filename) {
+	// strip directories and extension of the video file name
+	string video_name = filename;
+	size_t slash = video_name.rfind('/');
+	if (slash != string::npos)
+		video_name = video_name.substr(slash + 1);
+	size_t dot = video_name.rfind('.');
+	if (dot != string::npos)
+		video_name = video_name.substr(0, dot);
+
+	string path = options.debug_output_path + "_" + video_name;
+	if (options.debug_output_mode == DEBUG_OUTPUT_VIDEO)
+		path += ".avi";
+	return path;
+}
+
+bool OpenEventStream(const ProcessingOptions& options, EventStream *pevents) {
+	assert(pevents);
+	if (options.is_events_to_socket) {
+		std::unique_ptr<UnixSocketEventSink> sink(new UnixSocketEventSink());
+		if (!sink->Connect(options.events_path))
+			return false;
+		return pevents->Open(std::move(sink), EVENTS_QUEUE_SIZE);
+	}
+	std::unique_ptr<FileEventSink> sink(new FileEventSink());
+	if (!sink->Open(options.events_path))
+		return false;
+	return pevents->Open(std::move(sink), EVENTS_QUEUE_SIZE);
+}
+
+void PushEvent(EventStream *pevents, AbandonmentEvent::Type type,
+    const string& filename, const AccumulatedObject& object) {
+	if (!pevents)
+		return;
+	AbandonmentEvent event;
+	event.type = type;
+	event.video = filename;
+	event.appear_frame = object.appear_frame;
+	event.last_frame = object.last_frame;
+	event.bounding_rectangle = object.bounding_rectangle;
+	pevents->Push(event);
+}
+
 bool ReadTestFile(string filename, vector<string> *ptest_files) {
 	assert(ptest_files);
 	ptest_files->clear();
@@ -116,39 +435,20 @@ bool ReadTestFile(string filename, vector<string> *ptest_files) {
 	return true;
 }
 
-bool AreAlmostSimilar(Rect& bounding_rectangle1, Rect& bounding_rectangle2) {
-	if (abs(bounding_rectangle1.x - bounding_rectangle2.x) <
-	    MAX_SIMILAR_DISTANCE &&
-	    abs(bounding_rectangle1.y - bounding_rectangle2.y) <
-	    MAX_SIMILAR_DISTANCE &&
-	    abs(bounding_rectangle1.width - bounding_rectangle2.width) <
-	    MAX_SIMILAR_DISTANCE &&
-	    abs(bounding_rectangle1.height - bounding_rectangle2.height) <
-	     MAX_SIMILAR_DISTANCE) 
-		return true;
-	return false;
-}
-
-void VisualizeVideoProcessing(const Mat& frame, const Mat& foreground_mask_mog,
-    const Mat& eroded, const Mat& dilated, VideoCapture& capture,
+Mat DrawProcessingState(const Mat& frame, unsigned int frame_num,
     const vector<Rect>& bounding_rectangles, 
-    const list<AccumulatedObject>& objects_accumulator,
+    const vector<AccumulatedObject>& objects_accumulator,
     const vector<AccumulatedObject>& found_objects) {
-	Mat tmp_frame = frame.clone();
-
-	static bool is_first_call = true;
-	if (is_first_call) {
-		namedWindow("Frame");
-		namedWindow("FG Mask MOG");
-		namedWindow("FG Mask MOG eroded");
-		namedWindow("FG Mask MOG dilated");
-	}
-	is_first_call = false;
+	Mat tmp_frame;
+	if (frame.channels() == 1)
+		cvtColor(frame, tmp_frame, CV_GRAY2BGR);
+	else
+		tmp_frame = frame.clone();
 
 	stringstream ss;
 	rectangle(tmp_frame, cv::Point(10, 2), cv::Point(100,20), 
 	    cv::Scalar(255,255,255), -1);
-	ss << capture.get(CV_CAP_PROP_POS_FRAMES);
+	ss << frame_num;
 	string frameNumberString = ss.str();
 	putText(tmp_frame, frameNumberString.c_str(), cv::Point(15, 15), 
 	    FONT_HERSHEY_SIMPLEX, 0.5 , cv::Scalar(0,0,0));
@@ -156,7 +456,7 @@ void VisualizeVideoProcessing(const Mat& frame, const Mat& foreground_mask_mog,
 	for (const Rect& bounding_rectangle : bounding_rectangles)
 		rectangle(tmp_frame, bounding_rectangle.tl(), 
 		    bounding_rectangle.br(), Scalar(0, 0, 255), 2, 8, 0);
-	for (AccumulatedObject accum : objects_accumulator) {
+	for (const AccumulatedObject& accum : objects_accumulator) {
 		unsigned char luminance = 255;
 		if (accum.frames_count < MIN_FRAMES)
 			luminance = 255 * accum.frames_count / MIN_FRAMES;
@@ -164,113 +464,471 @@ void VisualizeVideoProcessing(const Mat& frame, const Mat& foreground_mask_mog,
 		    accum.bounding_rectangle.br(), Scalar(0, luminance, 0), 2, 
 		    8, 0);
 	}
-	for (AccumulatedObject accum : found_objects) 
+	for (const AccumulatedObject& accum : found_objects) 
 		rectangle(tmp_frame, accum.bounding_rectangle.tl(),
 		    accum.bounding_rectangle.br(), Scalar(255, 0, 0), 2, 8, 0);
 
+	return tmp_frame;
+}
 
-	imshow("Frame", tmp_frame);
-	imshow("FG Mask MOG", foreground_mask_mog);
-	imshow("FG Mask MOG eroded", eroded);
-	imshow("FG Mask MOG dilated", dilated);
+void ShowProcessingState(const DebugFrame& debug_frame) {
+	imshow("Frame", debug_frame.annotated);
+	imshow("FG Mask MOG", debug_frame.foreground_mask_mog);
+	imshow("FG Mask MOG eroded", debug_frame.eroded);
+	imshow("FG Mask MOG dilated", debug_frame.dilated);
 
 	waitKey(30);
 }
 
-bool ProcessVideo(string filename, vector<AccumulatedObject> *pfound_objects) {
+bool ProcessVideo(string filename, const ProcessingOptions& options,
+    vector<AccumulatedObject> *pfound_objects, ProcessingStats *pstats) {
+	if (options.shards_count > 1)
+		return ProcessVideoSharded(filename, options, pfound_objects, pstats);
+	VideoFileSource source;
+	if (!source.Open(filename, options.is_luma_only))
+		return false;
+	return ProcessFrames(source, filename, options, FrameRange(),
+	    pfound_objects, pstats);
+}
+
+bool ProcessVideoSharded(const string& filename,
+    const ProcessingOptions& options, vector<AccumulatedObject> *pfound_objects,
+    ProcessingStats *pstats) {
 	assert(pfound_objects);
 	pfound_objects->clear();
+	VideoFileSource probe;
+	if (!probe.Open(filename, options.is_luma_only))
+		return false;
+	unsigned int frames_count = probe.FramesCount();
+	unsigned int shards_count = std::min(options.shards_count,
+	    std::max(frames_count, 1u));
+	unsigned int shard_size = (frames_count + shards_count - 1) /
+	    shards_count;
+
+	std::chrono::steady_clock::time_point start_time =
+	    std::chrono::steady_clock::now();
+	vector<vector<AccumulatedObject> > shard_objects(shards_count);
+	vector<ProcessingStats> shard_stats(shards_count);
+	vector<char> is_shard_processed(shards_count, false);
+	vector<std::thread> threads;
+	for (unsigned int i = 0; i < shards_count; i++) {
+		unsigned int begin = i * shard_size;
+		// frame count of the container may be inexact, so the last shard
+		// reads to the end of the video
+		unsigned int end = i + 1 < shards_count ? begin + shard_size :
+		    std::numeric_limits<unsigned int>::max();
+		threads.push_back(std::thread([&, i, begin, end]() {
+			is_shard_processed[i] = ProcessShard(filename, options, begin,
+			    end, &shard_objects[i], &shard_stats[i]);
+		}));
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+	for (char is_processed : is_shard_processed)
+		if (!is_processed)
+			return false;
+
+	MergeShardObjects(shard_objects, pfound_objects);
+	ProcessingStats stats;
+	for (const ProcessingStats& shard : shard_stats) {
+		stats.total_frames += shard.total_frames;
+		stats.processed_frames += shard.processed_frames;
+		stats.converted_frames += shard.converted_frames;
+		stats.evicted_candidates += shard.evicted_candidates;
+		stats.mog_bytes += shard.mog_bytes;
+	}
+	stats.seconds = std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start_time).count();
+	if (pstats)
+		*pstats = stats;
+	return true;
+}
 
-
-	BackgroundSubtractorMOG *pmog = new BackgroundSubtractorMOG(); 
-	VideoCapture capture(filename);
-	if(!capture.isOpened())
+bool ProcessShard(const string& filename, const ProcessingOptions& options,
+    unsigned int begin, unsigned int end,
+    vector<AccumulatedObject> *pfound_objects, ProcessingStats *pstats) {
+	VideoFileSource source;
+	if (!source.Open(filename, options.is_luma_only))
 		return false;
+	FrameRange range;
+	range.begin = begin;
+	range.end = end;
+	// the background model converges on the frames preceding the range
+	unsigned int warmup_begin = begin > options.shard_warmup_frames ?
+	    begin - options.shard_warmup_frames : 0;
+	if (warmup_begin > 0) {
+		if (!source.Seek(warmup_begin))
+			return false;
+		// frames are numbered from the keyframe the backend has stopped at
+		range.first = source.Position();
+		// a backend stopping past the range start loses frames of the
+		// range, such shard reads the video from the start
+		if (range.first > begin) {
+			if (!source.Open(filename, options.is_luma_only))
+				return false;
+			range.first = 0;
+		}
+	}
+
+	// Objects are merged after all shards finish, so they are collected
+	// even in long running mode (its candidates cap is kept).
+	ProcessingOptions shard_options = options;
+	shard_options.is_long_running = false;
+	shard_options.debug_output_mode = DEBUG_OUTPUT_NONE;
+	shard_options.pevents = NULL;
+	return ProcessFrames(source, filename, shard_options, range,
+	    pfound_objects, pstats);
+}
 
-	Mat frame, foreground_mask_mog;
-	list<AccumulatedObject> objects_accumulator;
-	for (unsigned int frame_num = 0; capture.read(frame); frame_num++) {
-		//update the background model
-		pmog->operator()(frame, foreground_mask_mog);
-
-		// erode/dilate
-		Mat eroded, dilated;
-		Mat erosion_element = getStructuringElement(MORPH_ELLIPSE, 
-		    Size(2 * EROSION_SIZE + 1, 2 * EROSION_SIZE + 1),
-		    Point(EROSION_SIZE, EROSION_SIZE));
-		erode(foreground_mask_mog, eroded, erosion_element);
-
-		Mat dilation_element = getStructuringElement(MORPH_ELLIPSE, 
-		    Size(2 * DILATION_SIZE + 1, 2 * DILATION_SIZE + 1),
-		    Point(DILATION_SIZE, DILATION_SIZE));
-		dilate(eroded, dilated, dilation_element);
-
-		// find contours
-		Mat tmp_dilated = dilated.clone();
-		vector<vector<Point>> contours;
-		vector<Vec4i> hierarchy;
-		findContours(tmp_dilated, contours, hierarchy, CV_RETR_EXTERNAL, 
-		    CV_CHAIN_APPROX_SIMPLE, Point(0, 0));
-
-		// find bounding rectangles
-		vector<vector<Point>> contours_poly(contours.size());
-		vector<Rect> bounding_rectangles(contours.size());
-
-		unsigned int objects_count = 0;
-		for (unsigned int i = 0; i < contours.size(); i++) {
-			approxPolyDP(Mat(contours[i]), contours_poly[i], 3,
-			    true);
-			Rect tmp_bounding_rectangle = 
-			    boundingRect(Mat(contours_poly[i]));
-			bounding_rectangles[objects_count++] = 
-			    tmp_bounding_rectangle;
+void MergeShardObjects(const vector<vector<AccumulatedObject> >& shard_objects,
+    vector<AccumulatedObject> *pfound_objects) {
+	assert(pfound_objects);
+	pfound_objects->clear();
+	// Object appearing right at the boundary may be seen by both shards, as
+	// their background models differ a little. The one of the next shard
+	// overlapping in time and place with an object of the previous one is
+	// dropped, the previous shard has seen the whole timespan.
+	for (size_t i = 0; i < shard_objects.size(); i++)
+		for (const AccumulatedObject& object : shard_objects[i]) {
+			bool is_duplicate = false;
+			for (size_t j = 0; i > 0 && j < shard_objects[i - 1].size() &&
+			    !is_duplicate; j++) {
+				const AccumulatedObject& previous = shard_objects[i - 1][j];
+				is_duplicate = AreAlmostSimilar(previous.bounding_rectangle,
+				    object.bounding_rectangle) &&
+				    previous.appear_frame <= object.last_frame &&
+				    object.appear_frame <= previous.last_frame;
+			}
+			if (!is_duplicate)
+				pfound_objects->push_back(object);
 		}
-		bounding_rectangles.resize(objects_count);
-
-		// for each accumulated rectangle check if it appears in current frame
-		for (Rect& bounding_rectangle : bounding_rectangles) {
-			bool is_new_object = true;
-			for(AccumulatedObject& accum : objects_accumulator) 
-				// if yes - update accumulator
-				if (AreAlmostSimilar(bounding_rectangle, 
-				    accum.bounding_rectangle)) {
-					accum.frames_count++;
-					accum.last_frame = frame_num;
-					is_new_object = false;
-					break;
-				}
-			// if no - it's new object. Create new accumulator for it
-			if (is_new_object)
-				objects_accumulator.emplace_back(frame_num, 1,
-				    frame_num, bounding_rectangle);
+	// the serial run finds objects in the order they disappear
+	std::stable_sort(pfound_objects->begin(), pfound_objects->end(),
+	    [](const AccumulatedObject& object1,
+	    const AccumulatedObject& object2) {
+		return object1.last_frame < object2.last_frame;
+	});
+}
+
+bool PrepareFrame(const ProcessingOptions& options, Mat *pframe) {
+	assert(pframe);
+	Mat &frame = *pframe;
+	if (options.is_luma_only && frame.channels() == 2) {
+		// raw packed YUYV, luma is the first channel
+		Mat luma;
+		extractChannel(frame, luma, 0);
+		frame = luma;
+	}
+	else if (options.is_luma_only && frame.channels() == 3) {
+		// the backend has ignored CV_CAP_PROP_CONVERT_RGB
+		cvtColor(frame, frame, CV_BGR2GRAY);
+		return true;
+	}
+	return false;
+}
+
+bool ProcessFrames(FrameSource& source, const string& filename,
+    const ProcessingOptions& options, const FrameRange& range,
+    vector<AccumulatedObject> *pfound_objects, ProcessingStats *pstats) {
+	assert(pfound_objects);
+	pfound_objects->clear();
+
+	DebugFrameWriter debug_writer;
+	if (options.debug_output_mode == DEBUG_OUTPUT_VIDEO ||
+	    options.debug_output_mode == DEBUG_OUTPUT_IMAGES)
+		if (!debug_writer.Open(options.debug_output_mode,
+		    options.debug_output_path, options.debug_queue_size)) {
+			cerr << "Cannot open debug output " <<
+			    options.debug_output_path << "\n";
+			return false;
 		}
 
-		// delete all accumulated objects which are eliminated in this frame
-		for (auto iaccum = objects_accumulator.begin(); 
-		    iaccum != objects_accumulator.end();) 
-			if (iaccum->last_frame != frame_num) {
-				// if it has been appeared in more than MIN_FRAMES
-				// frames - it's stable object - add it to found objects
-				if (iaccum->frames_count >= MIN_FRAMES)
-					pfound_objects->push_back(*iaccum);
-				iaccum = objects_accumulator.erase(iaccum);
+	std::chrono::steady_clock::time_point start_time =
+	    std::chrono::steady_clock::now();
+	ProcessingStats stats;
+
+	// with the candidates cap all the storage is allocated once
+	AbandonmentDetector detector(options.max_candidates);
+	Mat frame, prev_small_frame;
+	vector<AccumulatedObject> started_objects, ended_objects;
+	// In adaptive rate mode skipped frames are only grabbed, not retrieved.
+	// frames_count of the objects grows by the number of frames since the
+	// previous processed frame, so MIN_FRAMES stays a duration.
+	unsigned int frame_step = 1, next_frame = range.first;
+	for (unsigned int frame_num = range.first; source.Grab(); frame_num++) {
+		// lost frames take their time as well
+		frame_num += source.LostFrames();
+		// Past the range objects appeared in it are followed until they
+		// disappear, so objects spanning the boundary of two ranges are
+		// found once and with the whole timespan.
+		if (frame_num >= range.end) {
+			bool is_following = false;
+			for (const AccumulatedObject& accum : detector.Candidates())
+				is_following = is_following || range.Owns(accum);
+			if (!is_following)
+				break;
+		}
+		// warm-up and followed frames belong to the neighbour shards
+		bool is_owned = range.Owns(frame_num);
+		if (is_owned)
+			stats.total_frames++;
+		if (options.memory_report_period > 0 &&
+		    frame_num % options.memory_report_period == 0) {
+			size_t rss_kb = 0, peak_rss_kb = 0;
+			ReadMemoryUsage(&rss_kb, &peak_rss_kb);
+			cerr << filename << ": frame " << frame_num << ", rss " <<
+			    rss_kb << " kB, peak rss " << peak_rss_kb <<
+			    " kB, candidates " << detector.Candidates().size() <<
+			    ", evicted " << detector.EvictedCandidates() << "\n";
+		}
+		if (frame_num < next_frame)
+			continue;
+		if (!source.Retrieve(&frame))
+			break;
+		bool is_converted = PrepareFrame(options, &frame);
+		if (is_owned) {
+			stats.processed_frames++;
+			if (is_converted)
+				stats.converted_frames++;
+		}
+		// traffic of the warm-up and followed frames is the cost of
+		// sharding, it is counted too
+		// input is read once, every gaussian is read and written back
+		stats.mog_bytes += (double) frame.total() * (frame.channels() +
+		    2 * MOG_MIXTURES * (1 + 2 * frame.channels()) * sizeof(float));
+
+		started_objects.clear();
+		ended_objects.clear();
+		detector.ProcessFrame(frame, frame_num, &started_objects,
+		    &ended_objects);
+		for (const AccumulatedObject& accum : started_objects)
+			if (range.Owns(accum))
+				PushEvent(options.pevents, AbandonmentEvent::BEGIN,
+				    filename, accum);
+		for (const AccumulatedObject& accum : ended_objects) {
+			if (!range.Owns(accum))
+				continue;
+			PushEvent(options.pevents, AbandonmentEvent::END, filename,
+			    accum);
+			if (options.is_long_running) {
+				*options.presults << filename << ": ";
+				PrintObject(*options.presults, accum);
+				*options.presults << std::endl;
 			}
 			else
-				iaccum++;
+				pfound_objects->push_back(accum);
+		}
 
-#ifdef VISUALIZATION
-		VisualizeVideoProcessing(frame, foreground_mask_mog, eroded,
-		    dilated, capture, bounding_rectangles, objects_accumulator,
-		    *pfound_objects); 
-#endif
+		// nothing is drawn or copied when debug output is off
+		if (options.debug_output_mode != DEBUG_OUTPUT_NONE) {
+			DebugFrame debug_frame;
+			debug_frame.frame_num = frame_num;
+			debug_frame.annotated = DrawProcessingState(frame,
+			    frame_num, detector.BoundingRectangles(),
+			    detector.Candidates(), *pfound_objects);
+			// MOG mask buffer is reused by the next frame
+			debug_frame.foreground_mask_mog =
+			    detector.ForegroundMask().clone();
+			debug_frame.eroded = detector.Eroded().clone();
+			debug_frame.dilated = detector.Dilated().clone();
+			if (options.debug_output_mode == DEBUG_OUTPUT_WINDOWS)
+				ShowProcessingState(debug_frame);
+			else
+				debug_writer.Push(debug_frame);
+			// processing stops with the debug output it was asked for
+			if (debug_writer.IsFailed())
+				break;
+		}
+
+		if (options.max_frame_step > 1)
+			frame_step = NextFrameStep(frame, &prev_small_frame,
+			    frame_step, options.max_frame_step);
+		next_frame = frame_num + frame_step;
 	}
 
-	capture.release();
-	delete pmog;
+	// objects still present at the end of the video are closed too
+	ended_objects.clear();
+	detector.Finish(&ended_objects);
+	for (const AccumulatedObject& accum : ended_objects)
+		if (range.Owns(accum))
+			PushEvent(options.pevents, AbandonmentEvent::END, filename,
+			    accum);
+	stats.evicted_candidates = detector.EvictedCandidates();
+
+	if (options.debug_output_mode == DEBUG_OUTPUT_WINDOWS)
+		destroyAllWindows();
+	debug_writer.Close();
+	if (debug_writer.IsFailed()) {
+		cerr << "Cannot write debug output " << options.debug_output_path <<
+		    "\n";
+		return false;
+	}
+	if (debug_writer.DroppedCount() > 0)
+		cerr << filename << ": " << debug_writer.DroppedCount() <<
+		    " debug frames dropped\n";
+
+	stats.seconds = std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start_time).count();
+	if (pstats)
+		*pstats = stats;
+	return true;
+}
+
+bool RunSoakTest(double hours, const ProcessingOptions& options) {
+	ProcessingOptions soak_options = options;
+	soak_options.is_long_running = true;
+	if (soak_options.memory_report_period == 0)
+		soak_options.memory_report_period = SOAK_REPORT_PERIOD;
+	soak_options.debug_output_path = DebugOutputPath(options, "soak");
+
+	SyntheticFrameSource source(
+	    (unsigned long long) (hours * 3600 * SOAK_FPS),
+	    Size(SOAK_FRAME_WIDTH, SOAK_FRAME_HEIGHT), 0);
+	vector<AccumulatedObject> found_objects;
+	ProcessingStats stats;
+	if (!ProcessFrames(source, "soak", soak_options, FrameRange(),
+	    &found_objects, &stats))
+		return false;
+
+	size_t rss_kb = 0, peak_rss_kb = 0;
+	ReadMemoryUsage(&rss_kb, &peak_rss_kb);
+	*options.presults << "soak: " << stats.total_frames << " frames in " <<
+	    stats.seconds << "s, " << stats.evicted_candidates <<
+	    " candidates evicted, rss " << rss_kb << " kB, peak rss " <<
+	    peak_rss_kb << " kB" << std::endl;
+	return true;
+}
+
+bool ProcessSharedMemoryRing(const ProcessingOptions& options) {
+	ShmFrameSource source;
+	if (!source.Open(options.shm_name)) {
+		cerr << "Cannot open frame ring " << options.shm_name << "\n";
+		return false;
+	}
+
+	string name = "shm:" + options.shm_name;
+	ProcessingOptions ring_options = options;
+	ring_options.debug_output_path = DebugOutputPath(options, name);
+	vector<AccumulatedObject> found_objects;
+	ProcessingStats stats;
+	if (!ProcessFrames(source, name, ring_options, FrameRange(),
+	    &found_objects, &stats))
+		return false;
+
+	if (!options.is_long_running) {
+		*options.presults << name << ": ";
+		for (const AccumulatedObject& obj : found_objects)
+			PrintObject(*options.presults, obj);
+		*options.presults << std::endl;
+	}
+	cerr << name << ": " << source.ReceivedFrames() << " frames received ("
+	    << source.ReceivedFrames() / std::max(stats.seconds, 1e-6) <<
+	    " fps), " << source.DroppedFrames() << " dropped, " <<
+	    source.TornFrames() << " torn\n";
+	return true;
+}
+
+void PrintObject(std::ostream& out, const AccumulatedObject& obj) {
+	out << "rectangle: (" <<
+	    obj.bounding_rectangle.x << ", " << 
+	    obj.bounding_rectangle.y << ", " <<
+	    obj.bounding_rectangle.width << ", " << 
+	    obj.bounding_rectangle.height << ") - " <<
+	    "timespan: (" << obj.appear_frame << ", " <<
+	    obj.last_frame << ")";
+}
+
+unsigned int NextFrameStep(const Mat& frame, Mat *pprev_small_frame,
+    unsigned int frame_step, unsigned int max_frame_step) {
+	assert(pprev_small_frame);
+	Mat small_frame;
+	resize(frame, small_frame, Size(frame.cols / MOTION_DOWNSCALE,
+	    frame.rows / MOTION_DOWNSCALE), 0, 0, INTER_AREA);
+	if (small_frame.channels() != 1)
+		cvtColor(small_frame, small_frame, CV_BGR2GRAY);
+
+	bool is_static = false;
+	if (!pprev_small_frame->empty()) {
+		Mat difference;
+		absdiff(small_frame, *pprev_small_frame, difference);
+		is_static = mean(difference)[0] < MOTION_THRESHOLD;
+	}
+	*pprev_small_frame = small_frame;
+
+	// slow down gradually while the scene is static, return to the full
+	// rate at once on any motion
+	if (!is_static)
+		return 1;
+	return std::min(2 * frame_step, max_frame_step);
+}
+
+bool CompareWithReference(const string& filename,
+    const ProcessingOptions& options) {
+	// both runs are made without any output
+	ProcessingOptions tested_options;
+	tested_options.max_frame_step = options.max_frame_step;
+	tested_options.is_luma_only = options.is_luma_only;
+	tested_options.shards_count = options.shards_count;
+	tested_options.shard_warmup_frames = options.shard_warmup_frames;
+	ProcessingOptions reference_options = tested_options;
+	// timespans may differ by the frame step and by the shards tolerance
+	int tolerance = options.max_frame_step;
+	if (options.compare_mode == COMPARE_FULL_RATE)
+		reference_options.max_frame_step = 1;
+	else if (options.compare_mode == COMPARE_SERIAL) {
+		reference_options.shards_count = 1;
+		tolerance += SHARD_FRAME_TOLERANCE;
+	}
+	else
+		reference_options.is_luma_only = false;
+
+	vector<AccumulatedObject> reference_objects, tested_objects;
+	ProcessingStats reference_stats, tested_stats;
+	if (!ProcessVideo(filename, reference_options, &reference_objects,
+	    &reference_stats))
+		return false;
+	if (!ProcessVideo(filename, tested_options, &tested_objects,
+	    &tested_stats))
+		return false;
+
+	// reference object is found if tested run has similar object with
+	// timespan shifted by less than the tolerance
+	unsigned int agreed = 0;
+	for (const AccumulatedObject& reference : reference_objects)
+		for (const AccumulatedObject& tested : tested_objects)
+			if (AreAlmostSimilar(reference.bounding_rectangle,
+			    tested.bounding_rectangle) &&
+			    abs((int) reference.appear_frame -
+			    (int) tested.appear_frame) <= tolerance &&
+			    abs((int) reference.last_frame -
+			    (int) tested.last_frame) <= tolerance) {
+				agreed++;
+				break;
+			}
 
-#ifdef VISUALIZATION
-	destroyAllWindows();
-#endif
+	// results go with the rest of them, not to the events on stdout
+	char summary[256];
+	snprintf(summary, sizeof(summary), "processed %u of %u frames "
+	    "(%.1f%% saved), time %.2fs vs %.2fs (%.1f vs %.1f fps), "
+	    "MOG traffic %.1f vs %.1f MB, "
+	    "found %u of %zu reference objects, %zu objects total",
+	    tested_stats.processed_frames, tested_stats.total_frames,
+	    100.0 * (1.0 - (double) tested_stats.processed_frames /
+	    std::max(tested_stats.total_frames, 1u)),
+	    tested_stats.seconds, reference_stats.seconds,
+	    tested_stats.total_frames / std::max(tested_stats.seconds, 1e-6),
+	    reference_stats.total_frames /
+	    std::max(reference_stats.seconds, 1e-6),
+	    tested_stats.mog_bytes / 1e6, reference_stats.mog_bytes / 1e6,
+	    agreed, reference_objects.size(), tested_objects.size());
+	*options.presults << filename << ": " << summary << std::endl;
+	// luma decoded without BGR would save decoding work as well, tell
+	// whether it has happened
+	if (options.compare_mode == COMPARE_COLOR)
+		*options.presults << filename << ": " <<
+		    tested_stats.converted_frames << " of " <<
+		    tested_stats.processed_frames <<
+		    " luma frames converted from BGR" << std::endl;
 	return true;
 }
 
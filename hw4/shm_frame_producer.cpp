@@ -0,0 +1,197 @@
+// Stand-in for the decoder process feeding the abandonment detectors through
+// the shared memory frame ring. With --benchmark decodes the video once into
+// memory, forks consumer processes reading the ring in place and measures
+// the ring throughput.
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shm_frame_ring.h"
+
+using namespace cv;
+using std::string;
+using std::vector;
+
+const unsigned int DEFAULT_SLOTS_COUNT = 32;
+// Benchmark producer publishes frames for BENCHMARK_SECONDS
+const double BENCHMARK_SECONDS = 5;
+
+// Set by SIGINT and SIGTERM, producers stop publishing and remove the ring
+volatile sig_atomic_t is_stop_requested = 0;
+
+void RequestStop(int) {
+	is_stop_requested = 1;
+}
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start).count();
+}
+
+// Decodes the video and publishes its frames, at most fps frames per second
+// if fps > 0. Returns false if a pass over the video publishes nothing.
+bool Produce(const string& video, const string& shm_name,
+    unsigned int slots_count, double fps, bool is_loop) {
+	ShmFrameRingWriter ring;
+	unsigned long long frames_count = 0;
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	do {
+		VideoCapture capture(video);
+		if (!capture.isOpened())
+			return false;
+		unsigned long long pass_start_count = frames_count;
+		Mat frame;
+		while (!is_stop_requested && capture.read(frame)) {
+			if (frames_count == 0 &&
+			    !ring.Create(shm_name, slots_count, frame))
+				return false;
+			if (!ring.Write(frame))
+				return false;
+			frames_count++;
+			if (fps > 0) {
+				double delay = frames_count / fps -
+				    SecondsSince(start);
+				if (delay > 0)
+					std::this_thread::sleep_for(
+					    std::chrono::duration<double>(delay));
+			}
+		}
+		// an empty video would make the loop reopen it forever
+		if (!is_stop_requested && frames_count == pass_start_count)
+			return false;
+	} while (is_loop && !is_stop_requested);
+	ring.Close();
+
+	printf("%llu frames published, %.1f fps\n", frames_count,
+	    frames_count / SecondsSince(start));
+	return true;
+}
+
+// Consumer process of the benchmark: reads all frames in place
+void BenchmarkConsumer(const string& shm_name, int consumer_id) {
+	// the producer owns the ring, consumers are simply terminated
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	ShmFrameSource source;
+	if (!source.Open(shm_name)) {
+		fprintf(stderr, "consumer %d: cannot open the ring\n",
+		    consumer_id);
+		exit(-1);
+	}
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	double checksum = 0;
+	Mat frame;
+	while (source.Grab())
+		if (source.Retrieve(&frame))
+			checksum += sum(frame)[0];
+	double seconds = SecondsSince(start);
+	printf("consumer %d: %llu frames received (%.1f fps), %llu dropped, "
+	    "%llu torn\n", consumer_id, source.ReceivedFrames(),
+	    source.ReceivedFrames() / seconds, source.DroppedFrames(),
+	    source.TornFrames());
+	exit(checksum >= 0 ? 0 : -1);
+}
+
+bool Benchmark(const string& video, unsigned int slots_count,
+    int consumers_count) {
+	vector<Mat> frames;
+	VideoCapture capture(video);
+	Mat frame;
+	while (capture.read(frame))
+		frames.push_back(frame.clone());
+	if (frames.empty())
+		return false;
+
+	char shm_name[64] = {0};
+	sprintf(shm_name, "/cv_hw_ring_benchmark_%d", (int) getpid());
+	ShmFrameRingWriter ring;
+	if (!ring.Create(shm_name, slots_count, frames[0]))
+		return false;
+
+	vector<pid_t> consumers;
+	for (int i = 0; i < consumers_count; i++) {
+		pid_t pid = fork();
+		if (pid == 0)
+			BenchmarkConsumer(shm_name, i);
+		if (pid < 0) {
+			perror("Cannot start consumer");
+			for (pid_t consumer : consumers) {
+				kill(consumer, SIGTERM);
+				waitpid(consumer, NULL, 0);
+			}
+			ring.Close();
+			return false;
+		}
+		consumers.push_back(pid);
+	}
+	// let consumers open the ring
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	unsigned long long frames_count = 0;
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	while (!is_stop_requested && SecondsSince(start) < BENCHMARK_SECONDS)
+		ring.Write(frames[frames_count++ % frames.size()]);
+	double seconds = SecondsSince(start);
+	ring.Close();
+
+	printf("producer: %llu frames published (%.1f fps, %.2f GB/s)\n",
+	    frames_count, frames_count / seconds, frames_count *
+	    frames[0].total() * frames[0].elemSize() / seconds / 1e9);
+	for (pid_t pid : consumers)
+		waitpid(pid, NULL, 0);
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	unsigned int slots_count = DEFAULT_SLOTS_COUNT;
+	double fps = 0;
+	bool is_loop = false, is_benchmark = false;
+	vector<string> args;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--slots" && i + 1 < argc)
+			slots_count = atoi(argv[++i]);
+		else if (arg == "--fps" && i + 1 < argc)
+			fps = atof(argv[++i]);
+		else if (arg == "--loop")
+			is_loop = true;
+		else if (arg == "--benchmark")
+			is_benchmark = true;
+		else
+			args.push_back(arg);
+	}
+	if (args.size() != 2 || slots_count == 0) {
+		fprintf(stderr, "Usage: %s [--slots count] [--fps fps] [--loop] "
+		    "video shm_name\n       %s --benchmark [--slots count] "
+		    "video consumers_count\n", argv[0], argv[0]);
+		return -1;
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = RequestStop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	if (is_benchmark)
+		return Benchmark(args[0], slots_count, atoi(args[1].c_str())) ?
+		    0 : -1;
+	if (!Produce(args[0], args[1], slots_count, fps, is_loop)) {
+		fprintf(stderr, "Cannot publish frames of %s\n", args[0].c_str());
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,287 @@
+#include "shm_frame_ring.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <new>
+
+using namespace cv;
+using std::string;
+
+const uint64_t SHM_RING_MAGIC = 0x474e495246564348ULL; // "HCVFRING"
+const uint32_t SHM_RING_VERSION = 1;
+// Header takes the first page, every slot starts at the page boundary with
+// its sequence number followed by pixels at SLOT_PIXELS_OFFSET
+const size_t SHM_PAGE_SIZE = 4096;
+const size_t SLOT_PIXELS_OFFSET = 64;
+// Consumer polls for the new frame every POLL_INTERVAL_US microseconds
+const useconds_t POLL_INTERVAL_US = 200;
+
+struct ShmRingHeader {
+	std::atomic<uint64_t> magic; // set when the rest of header is ready
+	uint32_t version;
+	uint32_t slots_count;
+	int32_t rows;
+	int32_t cols;
+	int32_t type;
+	int32_t reserved;
+	uint64_t step;
+	uint64_t slot_size;
+	std::atomic<uint64_t> write_seq; // count of published frames
+	std::atomic<uint32_t> is_closed;
+};
+
+static size_t AlignToPage(size_t size) {
+	return (size + SHM_PAGE_SIZE - 1) / SHM_PAGE_SIZE * SHM_PAGE_SIZE;
+}
+
+static std::atomic<uint64_t>* SlotSeq(unsigned char *data,
+    uint32_t slots_count, uint64_t slot_size, uint64_t seq) {
+	return (std::atomic<uint64_t>*) (data + SHM_PAGE_SIZE +
+	    (seq % slots_count) * slot_size);
+}
+
+static unsigned char* SlotPixels(unsigned char *data, uint32_t slots_count,
+    uint64_t slot_size, uint64_t seq) {
+	return (unsigned char*) SlotSeq(data, slots_count, slot_size, seq) +
+	    SLOT_PIXELS_OFFSET;
+}
+
+// Tells whether the frames described by the header fit into their slots and
+// the slots fit into the mapping of size bytes
+static bool IsValidLayout(const ShmRingHeader& header, size_t size) {
+	if (header.slots_count == 0 || header.rows <= 0 || header.cols <= 0 ||
+	    header.type < 0 || header.type != CV_MAT_TYPE(header.type) ||
+	    CV_MAT_DEPTH(header.type) > CV_64F)
+		return false;
+	if (header.step != (uint64_t) header.cols * CV_ELEM_SIZE(header.type))
+		return false;
+	// slots are page aligned for the atomic sequence numbers
+	if (header.slot_size % SHM_PAGE_SIZE != 0 ||
+	    header.slot_size <= SLOT_PIXELS_OFFSET ||
+	    (uint64_t) header.rows > (header.slot_size - SLOT_PIXELS_OFFSET) /
+	    header.step)
+		return false;
+	return size >= SHM_PAGE_SIZE &&
+	    header.slots_count <= (size - SHM_PAGE_SIZE) / header.slot_size;
+}
+
+ShmFrameRingWriter::ShmFrameRingWriter():
+	data_ (NULL),
+	size_ (0),
+	pheader_ (NULL),
+	next_seq_ (0) {}
+
+ShmFrameRingWriter::~ShmFrameRingWriter() {
+	Close();
+}
+
+bool ShmFrameRingWriter::Create(const string& name, unsigned int slots_count,
+    const Mat& format_frame) {
+	static_assert(sizeof(ShmRingHeader) <= SHM_PAGE_SIZE,
+	    "ring header must fit the first page");
+	if (data_ || slots_count == 0 || format_frame.empty())
+		return false;
+
+	size_t step = format_frame.cols * format_frame.elemSize();
+	size_t slot_size = AlignToPage(SLOT_PIXELS_OFFSET +
+	    step * format_frame.rows);
+	size_t size = SHM_PAGE_SIZE + slots_count * slot_size;
+
+	int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (fd == -1)
+		return false;
+	if (ftruncate(fd, size) == -1) {
+		close(fd);
+		shm_unlink(name.c_str());
+		return false;
+	}
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		shm_unlink(name.c_str());
+		return false;
+	}
+
+	name_ = name;
+	data_ = (unsigned char*) data;
+	size_ = size;
+	next_seq_ = 0;
+	// the memory is zeroed by ftruncate, so all slot sequence numbers are 0
+	pheader_ = new (data_) ShmRingHeader;
+	pheader_->version = SHM_RING_VERSION;
+	pheader_->slots_count = slots_count;
+	pheader_->rows = format_frame.rows;
+	pheader_->cols = format_frame.cols;
+	pheader_->type = format_frame.type();
+	pheader_->reserved = 0;
+	pheader_->step = step;
+	pheader_->slot_size = slot_size;
+	pheader_->write_seq.store(0);
+	pheader_->is_closed.store(0);
+	pheader_->magic.store(SHM_RING_MAGIC, std::memory_order_release);
+	return true;
+}
+
+bool ShmFrameRingWriter::Write(const Mat& frame) {
+	if (!data_ || frame.rows != pheader_->rows ||
+	    frame.cols != pheader_->cols || frame.type() != pheader_->type)
+		return false;
+
+	std::atomic<uint64_t> *pslot_seq = SlotSeq(data_, pheader_->slots_count,
+	    pheader_->slot_size, next_seq_);
+	pslot_seq->store(2 * next_seq_ + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	unsigned char *pixels = SlotPixels(data_, pheader_->slots_count,
+	    pheader_->slot_size, next_seq_);
+	for (int row = 0; row < frame.rows; row++)
+		memcpy(pixels + row * pheader_->step, frame.ptr(row),
+		    pheader_->step);
+
+	pslot_seq->store(2 * next_seq_ + 2, std::memory_order_release);
+	next_seq_++;
+	pheader_->write_seq.store(next_seq_, std::memory_order_release);
+	return true;
+}
+
+void ShmFrameRingWriter::Close() {
+	if (!data_)
+		return;
+	pheader_->is_closed.store(1, std::memory_order_release);
+	munmap(data_, size_);
+	shm_unlink(name_.c_str());
+	data_ = NULL;
+	pheader_ = NULL;
+	size_ = 0;
+}
+
+ShmFrameSource::ShmFrameSource():
+	data_ (NULL),
+	size_ (0),
+	pheader_ (NULL),
+	rows_ (0),
+	cols_ (0),
+	type_ (0),
+	step_ (0),
+	slot_size_ (0),
+	slots_count_ (0),
+	next_seq_ (0),
+	current_seq_ (0),
+	has_frame_ (false),
+	lost_frames_ (0),
+	received_frames_ (0),
+	dropped_frames_ (0),
+	torn_frames_ (0) {}
+
+ShmFrameSource::~ShmFrameSource() {
+	Close();
+}
+
+bool ShmFrameSource::Open(const string& name) {
+	Close();
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd == -1)
+		return false;
+	struct stat shm_stat;
+	if (fstat(fd, &shm_stat) == -1 ||
+	    (size_t) shm_stat.st_size < SHM_PAGE_SIZE) {
+		close(fd);
+		return false;
+	}
+	void *data = mmap(NULL, shm_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+	data_ = (unsigned char*) data;
+	size_ = shm_stat.st_size;
+	pheader_ = (const ShmRingHeader*) data_;
+
+	if (pheader_->magic.load(std::memory_order_acquire) != SHM_RING_MAGIC ||
+	    pheader_->version != SHM_RING_VERSION ||
+	    !IsValidLayout(*pheader_, size_)) {
+		Close();
+		return false;
+	}
+	// the layout is used as validated, later header changes are ignored
+	rows_ = pheader_->rows;
+	cols_ = pheader_->cols;
+	type_ = pheader_->type;
+	step_ = pheader_->step;
+	slot_size_ = pheader_->slot_size;
+	slots_count_ = pheader_->slots_count;
+	next_seq_ = pheader_->write_seq.load(std::memory_order_acquire);
+	return true;
+}
+
+void ShmFrameSource::Close() {
+	if (data_)
+		munmap(data_, size_);
+	data_ = NULL;
+	pheader_ = NULL;
+	size_ = 0;
+	has_frame_ = false;
+}
+
+bool ShmFrameSource::Grab() {
+	if (!data_)
+		return false;
+	// the previous frame has been used in place, check it was not
+	// overwritten meanwhile
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (has_frame_ && SlotSeq(data_, slots_count_, slot_size_,
+	    current_seq_)->load(
+	    std::memory_order_acquire) != 2 * current_seq_ + 2)
+		torn_frames_++;
+	has_frame_ = false;
+	lost_frames_ = 0;
+
+	while (true) {
+		uint64_t written = pheader_->write_seq.load(
+		    std::memory_order_acquire);
+		if (written <= next_seq_) {
+			if (pheader_->is_closed.load(std::memory_order_acquire) &&
+			    written == pheader_->write_seq.load(
+			    std::memory_order_acquire))
+				return false;
+			usleep(POLL_INTERVAL_US);
+			continue;
+		}
+
+		// the slot of next frame is reused already, jump to the newest
+		// frame to get the most time before it's overwritten
+		if (written - next_seq_ >= slots_count_) {
+			dropped_frames_ += written - 1 - next_seq_;
+			lost_frames_ += written - 1 - next_seq_;
+			next_seq_ = written - 1;
+		}
+
+		uint64_t seq = next_seq_++;
+		if (SlotSeq(data_, slots_count_, slot_size_, seq)->load(
+		    std::memory_order_acquire) != 2 * seq + 2) {
+			// overwritten right now
+			dropped_frames_++;
+			lost_frames_++;
+			continue;
+		}
+		current_seq_ = seq;
+		has_frame_ = true;
+		received_frames_++;
+		return true;
+	}
+}
+
+bool ShmFrameSource::Retrieve(Mat *pframe) {
+	assert(pframe);
+	if (!has_frame_)
+		return false;
+	// shared memory is mapped read only, the frame must not be changed
+	*pframe = Mat(rows_, cols_, type_,
+	    SlotPixels(data_, slots_count_, slot_size_, current_seq_), step_);
+	return true;
+}
@@ -0,0 +1,83 @@
+// Lock-free ring of decoded frames in POSIX shared memory. One producer
+// process writes frames into the slots, any number of consumer processes read
+// them in place without copying and without any writes to the shared memory.
+// Every slot has a sequence number: 2n+1 while frame n is being written, 2n+2
+// when it is ready. A consumer which falls more than the ring size behind
+// jumps to the newest frame and counts the skipped ones as dropped. A frame
+// overwritten while the consumer still used it is counted as torn.
+
+#ifndef SHM_FRAME_RING_H
+#define SHM_FRAME_RING_H
+
+#include <opencv2/core/core.hpp>
+#include <string>
+
+#include "frame_source.h"
+
+struct ShmRingHeader;
+
+class ShmFrameRingWriter {
+public:
+	ShmFrameRingWriter();
+	~ShmFrameRingWriter();
+
+	// Creates the ring of slots_count frames of the same size and type as
+	// format_frame. name is the POSIX shared memory name ("/name").
+	bool Create(const std::string& name, unsigned int slots_count,
+	    const cv::Mat& format_frame);
+	// Copies the frame into the next slot and publishes it
+	bool Write(const cv::Mat& frame);
+	// Tells consumers that there will be no more frames and removes the name
+	void Close();
+
+private:
+	std::string name_;
+	unsigned char *data_;
+	size_t size_;
+	ShmRingHeader *pheader_;
+	unsigned long long next_seq_;
+};
+
+// Consumer side of the ring
+class ShmFrameSource : public FrameSource {
+public:
+	ShmFrameSource();
+	~ShmFrameSource();
+
+	// Opens the ring and starts from the next published frame
+	bool Open(const std::string& name);
+	// Waits for the next frame, returns false when the producer has closed
+	// the ring and all its frames are read
+	bool Grab();
+	// Wraps the frame in the slot, it's valid until the producer gets the
+	// whole ring ahead
+	bool Retrieve(cv::Mat *pframe);
+	unsigned int LostFrames() const { return lost_frames_; }
+
+	unsigned long long ReceivedFrames() const { return received_frames_; }
+	unsigned long long DroppedFrames() const { return dropped_frames_; }
+	unsigned long long TornFrames() const { return torn_frames_; }
+
+private:
+	void Close();
+
+	unsigned char *data_;
+	size_t size_;
+	const ShmRingHeader *pheader_;
+	// frames layout validated against the mapping size by Open
+	int rows_;
+	int cols_;
+	int type_;
+	size_t step_;
+	size_t slot_size_;
+	unsigned int slots_count_;
+	unsigned long long next_seq_;
+	unsigned long long current_seq_;
+	bool has_frame_;
+	unsigned int lost_frames_;
+	unsigned long long received_frames_;
+	unsigned long long dropped_frames_;
+	unsigned long long torn_frames_;
+};
+
+#endif // SHM_FRAME_RING_H
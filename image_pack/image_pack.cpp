@@ -0,0 +1,221 @@
+#include "image_pack.h"
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/highgui/highgui_c.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+
+using namespace cv;
+using std::string;
+using std::vector;
+using std::ifstream;
+using std::ofstream;
+using std::stringstream;
+
+const char PACK_MAGIC[8] = {'C', 'V', 'H', 'W', 'P', 'A', 'C', 'K'};
+const uint32_t PACK_VERSION = 1;
+// Pixels of every image start at the page boundary
+const uint64_t PACK_ALIGNMENT = 4096;
+
+struct PackHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t images_count;
+	uint64_t list_offset;
+	uint64_t list_size;
+	uint64_t index_offset;
+};
+
+struct PackIndexEntry {
+	uint64_t name_offset;
+	uint64_t name_size;
+	int32_t rows;
+	int32_t cols;
+	int32_t type;
+	int32_t reserved;
+	uint64_t step;
+	uint64_t data_offset;
+};
+
+static uint64_t AlignOffset(uint64_t offset) {
+	return (offset + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+}
+
+// Tells whether [offset, offset + size) lies within the file, the sum is not
+// computed so it cannot overflow
+static bool IsInside(uint64_t offset, uint64_t size, uint64_t file_size) {
+	return offset <= file_size && size <= file_size - offset;
+}
+
+// Tells whether the entry describes the image as Write makes it, with pixels
+// lying within the file
+static bool IsValidEntry(const PackIndexEntry& entry, uint64_t file_size) {
+	if (!IsInside(entry.name_offset, entry.name_size, file_size))
+		return false;
+	if (entry.rows <= 0 || entry.cols <= 0 || entry.type < 0 ||
+	    entry.type != CV_MAT_TYPE(entry.type) ||
+	    CV_MAT_DEPTH(entry.type) > CV_64F)
+		return false;
+	if (entry.step != (uint64_t) entry.cols * CV_ELEM_SIZE(entry.type) ||
+	    entry.data_offset % PACK_ALIGNMENT != 0)
+		return false;
+	// step * rows is computed only when it fits into the file
+	if ((uint64_t) entry.rows > file_size / entry.step)
+		return false;
+	return IsInside(entry.data_offset, entry.step * entry.rows, file_size);
+}
+
+ImagePack::ImagePack(): data_ (NULL), size_ (0) {}
+
+ImagePack::~ImagePack() {
+	Close();
+}
+
+bool ImagePack::Open(const string& file_name) {
+	Close();
+	int fd = open(file_name.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) == -1 ||
+	    (size_t) file_stat.st_size < sizeof(PackHeader)) {
+		close(fd);
+		return false;
+	}
+
+	// private writable mapping: pages are shared with the page cache until
+	// somebody draws on the image
+	void *data = mmap(NULL, file_stat.st_size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+	data_ = (unsigned char*) data;
+	size_ = file_stat.st_size;
+
+	const PackHeader *pheader = (const PackHeader*) data_;
+	if (memcmp(pheader->magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0 ||
+	    pheader->version != PACK_VERSION ||
+	    !IsInside(pheader->list_offset, pheader->list_size, size_) ||
+	    !IsInside(pheader->index_offset, (uint64_t) pheader->images_count *
+	    sizeof(PackIndexEntry), size_)) {
+		Close();
+		return false;
+	}
+	list_.assign((const char*) data_ + pheader->list_offset,
+	    pheader->list_size);
+
+	for (uint32_t i = 0; i < pheader->images_count; i++) {
+		// the index follows the names and is not aligned
+		PackIndexEntry entry;
+		memcpy(&entry, data_ + pheader->index_offset +
+		    i * sizeof(PackIndexEntry), sizeof(entry));
+		if (!IsValidEntry(entry, size_)) {
+			Close();
+			return false;
+		}
+		string name((const char*) data_ + entry.name_offset,
+		    entry.name_size);
+		images_[name] = Mat(entry.rows, entry.cols, entry.type,
+		    data_ + entry.data_offset, entry.step);
+	}
+	return true;
+}
+
+void ImagePack::Close() {
+	images_.clear();
+	list_.clear();
+	if (data_)
+		munmap(data_, size_);
+	data_ = NULL;
+	size_ = 0;
+}
+
+bool ImagePack::ReadList(const string& file_name, string *plist) {
+	assert(plist);
+	Close();
+	ifstream fin(file_name.c_str()); 
+	if (!fin.is_open())
+		return false;
+	// a file starting with the magic is a pack, broken one is an error
+	// rather than a list
+	char magic[sizeof(PACK_MAGIC)];
+	if (fin.read(magic, sizeof(magic)) &&
+	    memcmp(magic, PACK_MAGIC, sizeof(PACK_MAGIC)) == 0) {
+		if (!Open(file_name))
+			return false;
+		*plist = list_;
+		return true;
+	}
+
+	fin.clear();
+	fin.seekg(0);
+	stringstream ss;
+	ss << fin.rdbuf();
+	*plist = ss.str();
+	return true;
+}
+
+Mat ImagePack::LoadImage(const string& file_name) const {
+	std::map<string, Mat>::const_iterator i = images_.find(file_name);
+	if (i != images_.end())
+		return i->second;
+	return imread(file_name.c_str(), CV_LOAD_IMAGE_COLOR);
+}
+
+bool ImagePack::Write(const string& file_name, const string& list,
+    const vector<string>& names, const vector<Mat>& images) {
+	assert(names.size() == images.size());
+	PackHeader header;
+	memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+	header.version = PACK_VERSION;
+	header.images_count = images.size();
+	header.list_offset = sizeof(PackHeader);
+	header.list_size = list.size();
+
+	vector<PackIndexEntry> index(images.size());
+	uint64_t offset = header.list_offset + header.list_size;
+	for (size_t i = 0; i < names.size(); i++) {
+		index[i].name_offset = offset;
+		index[i].name_size = names[i].size();
+		offset += names[i].size();
+	}
+	header.index_offset = offset;
+	offset += index.size() * sizeof(PackIndexEntry);
+	for (size_t i = 0; i < images.size(); i++) {
+		offset = AlignOffset(offset);
+		index[i].rows = images[i].rows;
+		index[i].cols = images[i].cols;
+		index[i].type = images[i].type();
+		index[i].reserved = 0;
+		index[i].step = images[i].cols * images[i].elemSize();
+		index[i].data_offset = offset;
+		offset += index[i].step * images[i].rows;
+	}
+
+	ofstream fout(file_name.c_str(), std::ios::binary);
+	if (!fout.is_open())
+		return false;
+	fout.write((const char*) &header, sizeof(header));
+	fout.write(list.data(), list.size());
+	for (const string& name : names)
+		fout.write(name.data(), name.size());
+	fout.write((const char*) index.data(),
+	    index.size() * sizeof(PackIndexEntry));
+	for (size_t i = 0; i < images.size(); i++) {
+		// zero padding up to the aligned start of pixels
+		vector<char> padding(index[i].data_offset - fout.tellp(), 0);
+		fout.write(padding.data(), padding.size());
+		for (int row = 0; row < images[i].rows; row++)
+			fout.write((const char*) images[i].ptr(row),
+			    index[i].step);
+	}
+	return fout.good();
+}
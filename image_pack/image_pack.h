@@ -0,0 +1,56 @@
+// Pack of the pre-decoded images together with the list file describing them.
+// The pack is memory mapped, images are wrapped into cv::Mat without decoding
+// and copying. Mapping is private, so the programs drawing on the images
+// change only their own copy of the touched pages.
+//
+// File layout (native byte order):
+//   PackHeader
+//   list file text
+//   image names
+//   index: PackIndexEntry per image
+//   pixels of every image, each one aligned to PACK_ALIGNMENT
+
+#ifndef IMAGE_PACK_H
+#define IMAGE_PACK_H
+
+#include <opencv2/core/core.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+class ImagePack {
+public:
+	ImagePack();
+	~ImagePack();
+
+	// Maps the pack file, returns false if it's not a valid pack
+	bool Open(const std::string& file_name);
+	void Close();
+	bool IsOpened() const { return data_ != NULL; }
+
+	// Reads the list embedded in the pack (the pack becomes opened) or the
+	// whole text of the list file if file_name does not start with the pack
+	// magic. Returns false for the invalid pack.
+	bool ReadList(const std::string& file_name, std::string *plist);
+	// Wraps the packed image if the pack has it, otherwise decodes the file
+	// as a color image. Packed pixels are valid while the pack is opened.
+	cv::Mat LoadImage(const std::string& file_name) const;
+
+	size_t ImagesCount() const { return images_.size(); }
+
+	// Writes the pack of the list text and the named images
+	static bool Write(const std::string& file_name, const std::string& list,
+	    const std::vector<std::string>& names,
+	    const std::vector<cv::Mat>& images);
+
+private:
+	ImagePack(const ImagePack&);
+	ImagePack& operator=(const ImagePack&);
+
+	unsigned char *data_;
+	size_t size_;
+	std::string list_;
+	std::map<std::string, cv::Mat> images_;
+};
+
+#endif // IMAGE_PACK_H
@@ -0,0 +1,155 @@
+// Converts the list file of the image pipelines (hw1 "train"/"test", hw2
+// "test.txt", hw3 "learning_signs.txt"/"test_sample.txt") and all the images
+// it mentions into one pack file which the pipelines accept instead of the
+// list. With --benchmark compares loading of the images from the pack and
+// from the original files.
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/highgui/highgui_c.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "image_pack.h"
+
+using namespace cv;
+using std::string;
+using std::vector;
+using std::set;
+using std::stringstream;
+
+// Every token of the list file with one of these extensions is an image
+const char* IMAGE_EXTENSIONS[] = {".jpg", ".jpeg", ".png", ".bmp"};
+
+bool IsImageFileName(const string& token) {
+	size_t dot = token.rfind('.');
+	if (dot == string::npos)
+		return false;
+	string extension = token.substr(dot);
+	std::transform(extension.begin(), extension.end(), extension.begin(),
+	    ::tolower);
+	for (const char* image_extension : IMAGE_EXTENSIONS)
+		if (extension == image_extension)
+			return true;
+	return false;
+}
+
+// Finds names of all images mentioned in the list, each one once
+void ListImages(const string& list, vector<string> *pnames) {
+	assert(pnames);
+	set<string> seen;
+	stringstream ss(list);
+	string token;
+	while (ss >> token)
+		if (IsImageFileName(token) && seen.insert(token).second)
+			pnames->push_back(token);
+}
+
+bool PackImages(const string& list_file, const string& pack_file) {
+	ImagePack plain_list;
+	string list;
+	if (!plain_list.ReadList(list_file, &list) || plain_list.IsOpened()) {
+		fprintf(stderr, "Cannot read list file %s\n", list_file.c_str());
+		return false;
+	}
+
+	vector<string> names;
+	vector<Mat> images;
+	ListImages(list, &names);
+	for (const string& name : names) {
+		Mat img = imread(name.c_str(), CV_LOAD_IMAGE_COLOR);
+		if (!img.data) {
+			fprintf(stderr, "Cannot decode image %s\n", name.c_str());
+			return false;
+		}
+		images.push_back(img);
+	}
+
+	if (!ImagePack::Write(pack_file, list, names, images)) {
+		fprintf(stderr, "Cannot write pack file %s\n", pack_file.c_str());
+		return false;
+	}
+	printf("%zu images packed to %s\n", images.size(), pack_file.c_str());
+	return true;
+}
+
+// Evicts the file from the page cache to measure the cold load
+void DropFromPageCache(const string& file_name) {
+	int fd = open(file_name.c_str(), O_RDONLY);
+	if (fd == -1)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(
+	    std::chrono::steady_clock::now() - start).count();
+}
+
+// Loads all images from the files and sums the pixels to touch them
+double LoadFromFiles(const vector<string>& names, double *pchecksum) {
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	for (const string& name : names)
+		*pchecksum += sum(imread(name.c_str(), CV_LOAD_IMAGE_COLOR))[0];
+	return SecondsSince(start);
+}
+
+// Maps the pack, wraps all images and sums the pixels to touch them
+double LoadFromPack(const string& pack_file, const vector<string>& names,
+    double *pchecksum) {
+	std::chrono::steady_clock::time_point start =
+	    std::chrono::steady_clock::now();
+	ImagePack pack;
+	if (!pack.Open(pack_file))
+		return -1;
+	for (const string& name : names)
+		*pchecksum += sum(pack.LoadImage(name))[0];
+	return SecondsSince(start);
+}
+
+bool Benchmark(const string& list_file, const string& pack_file) {
+	ImagePack plain_list;
+	string list;
+	if (!plain_list.ReadList(list_file, &list) || plain_list.IsOpened())
+		return false;
+	vector<string> names;
+	ListImages(list, &names);
+
+	double files_checksum = 0, pack_checksum = 0;
+	for (const string& name : names)
+		DropFromPageCache(name);
+	double files_cold = LoadFromFiles(names, &files_checksum);
+	double files_warm = LoadFromFiles(names, &files_checksum);
+
+	DropFromPageCache(pack_file);
+	double pack_cold = LoadFromPack(pack_file, names, &pack_checksum);
+	double pack_warm = LoadFromPack(pack_file, names, &pack_checksum);
+	if (pack_cold < 0 || pack_warm < 0)
+		return false;
+
+	printf("%zu images: files cold %.3fs warm %.3fs, "
+	    "pack cold %.3fs warm %.3fs%s\n", names.size(),
+	    files_cold, files_warm, pack_cold, pack_warm,
+	    files_checksum == pack_checksum ? "" : " (PIXELS DIFFER)");
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (argc == 4 && string(argv[1]) == "--benchmark")
+		return Benchmark(argv[2], argv[3]) ? 0 : -1;
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s [--benchmark] list_file pack_file\n",
+		    argv[0]);
+		return -1;
+	}
+	return PackImages(argv[1], argv[2]) ? 0 : -1;
+}
@@ -0,0 +1,26 @@
+#include "memory_usage.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <fstream>
+#include <string>
+
+using std::ifstream;
+using std::string;
+
+bool ReadMemoryUsage(size_t *prss_kb, size_t *ppeak_rss_kb) {
+	assert(prss_kb);
+	assert(ppeak_rss_kb);
+	ifstream fin("/proc/self/status");
+	if (!fin.is_open())
+		return false;
+
+	string line;
+	while (std::getline(fin, line)) {
+		if (line.compare(0, 6, "VmRSS:") == 0)
+			*prss_kb = atol(line.c_str() + 6);
+		if (line.compare(0, 6, "VmHWM:") == 0)
+			*ppeak_rss_kb = atol(line.c_str() + 6);
+	}
+	return true;
+}
@@ -0,0 +1,11 @@
+// Memory usage of the process, shared by the programs reporting it
+
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include <stddef.h>
+
+// Reads resident and peak resident memory size of the process
+bool ReadMemoryUsage(size_t *prss_kb, size_t *ppeak_rss_kb);
+
+#endif // MEMORY_USAGE_H